@@ -0,0 +1,12 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+// a single triangle covering the whole viewport, drawn with 3 vertices
+// and without vertex input
+void main()
+{
+	vec2 uv = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);
+	gl_Position = vec4(2.0 * uv - 1.0, 0.0, 1.0);
+}
@@ -0,0 +1,262 @@
+// Copyright (c) 2017 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+// Data layouts of the simulation, included from the shaders and C++.
+// Must therefore only use the common subset of GLSL and C++.
+// The structs only contain scalars, vec2 and 16 byte structs at 16 byte
+// offsets and are used in std430 buffers, push constants or as only
+// member of std140 blocks, where C++ and GLSL agree on the layout.
+
+#ifndef PARTICLES_SHADER_LAYOUT
+#define PARTICLES_SHADER_LAYOUT
+
+#ifdef __cplusplus
+	#include <nytl/vec.hpp> // nytl::Vec2f
+	#include <cstdint> // std::uint32_t
+
+	namespace shader {
+	using uint = std::uint32_t;
+	using vec2 = nytl::Vec2f;
+#endif
+
+// maximum number of attractors per frame, determines the size
+// of the attractor buffer slices
+const uint maxAttractors = 1024u;
+
+// simulation constants
+const float attractionFactor = 5.0;
+const float frictionFactor = 0.7;
+const float separationFactor = 0.1; // particle-particle interaction
+
+struct Particle {
+	vec2 pos;
+	vec2 vel;
+};
+
+// compact particle format, 8 instead of 16 bytes. The position is stored
+// as snorm16 pair, scaled down by positionRange (positions outside are
+// clamped), the velocity as half floats
+const float positionRange = 2.0;
+
+struct CompactParticle {
+	uint pos; // packSnorm2x16(pos / positionRange)
+	uint vel; // packHalf2x16(vel)
+};
+
+// render stream entry, written by the simulation for the vertex input.
+// The position is quantized to streamPositionMax + 1 steps per axis
+// in [-1, 1]. The maximum value marks particles outside, they are
+// decoded slightly outside [-1, 1] and therefore clipped.
+// Layout: x (12 bit), y (12 bit), speed (8 bit unorm)
+const uint streamPositionMax = 4094u;
+
+// the particles can be sorted by the tile they are in for better
+// cache locality when drawing. The key is the morton code of the tile
+// on a grid of 2^sortGridBits tiles per axis over [-1, 1]
+const uint sortGridBits = 6u;
+const uint sortBins = 1u << (2u * sortGridBits);
+
+// number of bins of the spatial hash used to find the neighbours for
+// the particle interaction. The cells have the size of the interaction
+// radius and are hashed into the bins (see gridHash)
+const uint gridHashSize = 1u << 16u;
+
+// what happens to particles leaving [-1, 1]
+const uint borderNone = 0u; // nothing, they might come back
+const uint borderWrap = 1u; // enter on the opposite side
+const uint borderReflect = 2u; // bounce off
+const uint borderClamp = 3u; // stop at the border
+const uint borderRespawn = 4u; // respawn at a random position
+
+// particle lifecycle (see emit.comp): emitters spawn particles with a
+// lifetime into free slots, dead slots are moved out of the screen to
+// deadPosition and pushed onto a free list. Only the alive particles
+// are drawn, through an index list and an indirect draw
+const uint maxEmitters = 64u;
+const float deadPosition = positionRange; // in both coordinates
+
+struct Emitter {
+	vec2 pos; // normalized device coordinates
+	float speed; // initial speed, the direction is random
+	float lifetime; // in seconds, randomized down to half of it
+	uint first; // first spawn index of this emitter in the frame
+	uint count; // number of particles spawned in the frame
+};
+
+// per-frame header of the emitter buffer, followed by the emitters
+struct EmitHeader {
+	uint groups[3]; // indirect dispatch of the emit pass
+	uint emitterCount;
+	uint spawnCount; // sum of the emitter counts
+	uint frame; // seeds the random directions
+	uint pad0;
+	uint pad1;
+};
+
+// VkDrawIndexedIndirectCommand, at the start of the alive list buffer.
+// The simulation and emit pass append to indexCount. Without lifecycle
+// and culling, the simulation writes {particleCount, 1, 0, 0} which is
+// also a valid VkDrawIndirectCommand, so the draw never bakes in the count
+struct DrawCommand {
+	uint indexCount;
+	uint instanceCount;
+	uint firstIndex;
+	int vertexOffset;
+	uint firstInstance;
+};
+
+// view transform from the simulation domain into normalized device
+// coordinates, (pos - center) * zoom. Particles outside positionRange
+// are never drawn. drawFraction is the level of detail, the share
+// of the particles that is drawn when zoomed out
+const float minZoom = 0.25;
+const float maxZoom = 256.0;
+
+struct View {
+	vec2 center;
+	float zoom;
+	float drawFraction; // in (0, 1]
+};
+
+// per-frame data of the draw (particles.vert, splat.comp), uploaded
+// before every frame so that the recorded draws don't depend on it.
+// With a fixed simulation time step, the positions are extrapolated
+// by the time since the last step
+struct DrawData {
+	View view;
+	float extrapolate; // in seconds
+	float pad0;
+	float pad1;
+	float pad2;
+};
+
+// counted by the simulation, one per frame in flight
+struct FrameCounters {
+	uint live; // particles inside [-1, 1] after the step
+	uint culled; // alive particles left out of the alive list by culling
+};
+
+// per-frame simulation data, the attractor positions (vec2 in
+// normalized device coordinates) are stored in a separate buffer.
+// Padded to a multiple of 16 bytes since std140 rounds up the size
+// of structs
+struct FrameData {
+	float deltaT; // time delta in seconds
+	uint attractorCount; // <= maxAttractors
+	float interactionRadius; // no particle interaction if zero
+	uint frame; // seeds respawns, selects the live counter
+	View view; // of the frame, for the culling and level of detail
+	uint particleCount; // <= size of the bound particle buffers
+	uint pad0;
+	uint pad1;
+	uint pad2;
+};
+
+#ifdef __cplusplus
+	static_assert(sizeof(Particle) == 16);
+	static_assert(sizeof(CompactParticle) == 8);
+	static_assert(sizeof(View) == 16);
+	static_assert(sizeof(DrawData) == 32);
+	static_assert(sizeof(FrameData) == 48);
+	static_assert(sizeof(Emitter) == 24);
+	static_assert(sizeof(EmitHeader) == 32);
+	static_assert(sizeof(DrawCommand) == 20);
+	static_assert(sizeof(FrameCounters) == 8);
+	} // namespace shader
+#else
+	CompactParticle packParticle(Particle p) {
+		CompactParticle ret;
+		ret.pos = packSnorm2x16(p.pos / positionRange);
+		ret.vel = packHalf2x16(p.vel);
+		return ret;
+	}
+
+	Particle unpackParticle(CompactParticle p) {
+		Particle ret;
+		ret.pos = positionRange * unpackSnorm2x16(p.pos);
+		ret.vel = unpackHalf2x16(p.vel);
+		return ret;
+	}
+
+	uint packRenderParticle(Particle p) {
+		uvec2 pos = uvec2(round((0.5 + 0.5 * p.pos) * streamPositionMax));
+		if(any(greaterThan(abs(p.pos), vec2(1.0)))) {
+			pos = uvec2(streamPositionMax + 1);
+		}
+
+		float speed = clamp(0.5 * length(p.vel), 0.0, 1.0);
+		return pos.x | (pos.y << 12) | (uint(round(255.0 * speed)) << 24);
+	}
+
+	void unpackRenderParticle(uint data, out vec2 pos, out float speed) {
+		uvec2 ipos = uvec2(data & 0xFFFu, (data >> 12) & 0xFFFu);
+		pos = 2.0 * (vec2(ipos) / streamPositionMax) - 1.0;
+		speed = float(data >> 24) / 255.0;
+	}
+
+	// whether the render stream entry is marked as outside [-1, 1]
+	bool renderParticleOutside(uint data) {
+		return (data & 0xFFFu) > streamPositionMax;
+	}
+
+	vec2 viewPosition(View view, vec2 pos) {
+		return view.zoom * (pos - view.center);
+	}
+
+	bool viewVisible(View view, vec2 pos) {
+		return all(lessThan(abs(pos), vec2(positionRange))) &&
+			all(lessThanEqual(abs(viewPosition(view, pos)), vec2(1.0)));
+	}
+
+	// lowbias32 integer hash (Chris Wellons)
+	uint hash(uint x) {
+		x ^= x >> 16;
+		x *= 0x7feb352du;
+		x ^= x >> 15;
+		x *= 0x846ca68bu;
+		x ^= x >> 16;
+		return x;
+	}
+
+	// counter based rng, returns a uniform random value in [0, 1)
+	// that only depends on the arguments
+	float randomFloat(uint seed, uint index, uint stream) {
+		uint h = hash(hash(seed) ^ (2 * index + stream));
+		return float(h >> 8) * (1.0 / 16777216.0);
+	}
+
+	// whether the particle is part of the drawn subset with the given
+	// level of detail. Independent of the particle order
+	bool lodKeep(View view, uint index) {
+		return view.drawFraction >= 1.0 ||
+			randomFloat(0u, index, 0u) < view.drawFraction;
+	}
+
+	// the cpu simulation mirrors gridCell, gridHash and randomFloat
+	ivec2 gridCell(vec2 pos, float cellSize) {
+		vec2 cell = clamp(floor(pos / cellSize), vec2(-32768.0), vec2(32767.0));
+		return ivec2(cell);
+	}
+
+	uint gridHash(ivec2 cell) {
+		return ((uint(cell.x) * 73856093u) ^ (uint(cell.y) * 19349663u)) &
+			(gridHashSize - 1u);
+	}
+
+	// positions outside [-1, 1] are sorted into the border tiles
+	uint sortKey(vec2 pos) {
+		float size = float(1u << sortGridBits);
+		uvec2 tile = uvec2(clamp((0.5 + 0.5 * pos) * size, 0.0, size - 1.0));
+
+		uint key = 0u;
+		for(uint i = 0u; i < sortGridBits; ++i) {
+			key |= ((tile.x >> i) & 1u) << (2u * i);
+			key |= ((tile.y >> i) & 1u) << (2u * i + 1u);
+		}
+
+		return key;
+	}
+#endif
+
+#endif // PARTICLES_SHADER_LAYOUT
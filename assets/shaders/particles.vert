@@ -2,15 +2,53 @@
 
 #extension GL_ARB_separate_shader_objects : enable
 #extension GL_ARB_shading_language_420pack : enable
+#extension GL_GOOGLE_include_directive : require
+
+#include "particles.h"
+
+// the compact particle format stores the position scaled
+// down by positionRange as snorm16
+layout(constant_id = 0) const float positionScale = 1.0;
+
+// with RENDER_STREAM, the simulation writes a packed render stream
+// and the full particle state is never read here
+#ifdef RENDER_STREAM
+	layout(location = 0) in uint inPacked;
+#else
+	layout(location = 0) in vec2 inPos;
+	layout(location = 1) in vec2 inVel;
+#endif
 
-layout(location = 0) in vec2 inPos;
-layout(location = 1) in vec2 inVel;
 layout(location = 0) out vec2 outCol;
 
+// zoom, pan and extrapolation, see DrawData in particles.h. The level
+// of detail is applied by the simulation through the draw command.
+// The render stream has no velocity and is not extrapolated
+layout(set = 0, binding = 0) uniform DrawBlock {
+	DrawData draw;
+};
+
 void main()
 {
-	float green = 1.f - clamp(0.5 * length(inVel), 0.0, 1.0);
+#ifdef RENDER_STREAM
+	vec2 pos;
+	float speed;
+	unpackRenderParticle(inPacked, pos, speed);
+	bool outside = renderParticleOutside(inPacked);
+#else
+	vec2 pos = positionScale * inPos;
+	float speed = clamp(0.5 * length(inVel), 0.0, 1.0);
+	bool outside = any(greaterThanEqual(abs(pos), vec2(positionRange)));
+	pos += draw.extrapolate * inVel;
+#endif
+
+	float green = 1.f - speed;
 	outCol = vec2(1.0, green);
-	gl_Position = vec4(inPos, 0.0, 1.0);
+	gl_Position = vec4(viewPosition(draw.view, pos), 0.0, 1.0);
+
+	// clipped. Zoomed out, the clamped or marked positions would be visible
+	if(outside) {
+		gl_Position = vec4(2.0, 2.0, 0.0, 1.0);
+	}
 	// gl_PointSize = 2.0; // android
 }
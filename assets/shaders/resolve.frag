@@ -0,0 +1,31 @@
+#version 450
+
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+
+// alpha of a single particle in particles.frag
+const float particleAlpha = 0.05;
+
+// written by splat.comp, see there
+layout(std430, set = 0, binding = 0) readonly buffer Density {
+	uint density[];
+};
+
+layout(push_constant) uniform Params {
+	uint width; // of the density buffer in pixels
+} params;
+
+layout(location = 0) out vec4 outColor;
+
+void main()
+{
+	uvec2 pixel = uvec2(gl_FragCoord.xy);
+	uint i = 2 * (pixel.y * params.width + pixel.x);
+	float count = float(density[i]);
+	float green = float(density[i + 1]) / max(255.0 * count, 1.0);
+
+	// blending count particles of the same color with particleAlpha
+	// over black gives this. Approximated with their average color
+	float coverage = 1.0 - pow(1.0 - particleAlpha, count);
+	outColor = vec4(coverage * vec2(1.0, green), 0.0, 1.0);
+}
@@ -0,0 +1,469 @@
+// Copyright (c) 2017 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#include <cpuSimulation.hpp>
+#include <dlg/dlg.hpp> // dlg
+
+#include <algorithm> // std::clamp
+#include <thread> // std::thread
+#include <cmath> // std::sqrt
+
+#if defined(__x86_64__) || defined(__i386__)
+	#define PARTICLES_AVX2
+	#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+	#define PARTICLES_NEON
+	#include <arm_neon.h>
+#endif
+
+namespace {
+
+// fewer particles per thread are not worth starting it
+constexpr auto minParticlesPerThread = 16 * 1024u;
+
+// Everything a kernel needs for one step.
+// The kernels simulate the particles in [begin, end).
+struct StepData {
+	float* posX;
+	float* posY;
+	float* velX;
+	float* velY;
+	const float* attractX;
+	const float* attractY;
+	std::size_t attractorCount;
+	float delta;
+	float friction; // velocity factor per step
+	float fac; // attraction factor per attractor
+
+	// particle interaction, null if disabled. The kernels add
+	// forceX/Y after the attraction
+	float* forceX;
+	float* forceY;
+	const float* cellX;
+	const float* cellY;
+	const std::uint32_t* cellEnds;
+	float radius;
+	float separation; // separation factor for the time step
+
+	unsigned border; // border policy, one of the constants in particles.h
+	std::uint32_t frame; // seeds the respawns
+};
+
+using Kernel = void(*)(const StepData&, std::size_t begin, std::size_t end);
+
+// Mirror gridCell and gridHash in particles.h
+std::int32_t gridCell(float pos, float cellSize)
+{
+	return static_cast<std::int32_t>(
+		std::clamp(std::floor(pos / cellSize), -32768.f, 32767.f));
+}
+
+std::uint32_t gridHash(std::int32_t x, std::int32_t y)
+{
+	return ((std::uint32_t(x) * 73856093u) ^ (std::uint32_t(y) * 19349663u)) &
+		(shader::gridHashSize - 1u);
+}
+
+// Mirror hash and randomFloat in particles.h
+std::uint32_t hash(std::uint32_t x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return x;
+}
+
+float randomFloat(std::uint32_t seed, std::uint32_t index, std::uint32_t stream)
+{
+	auto h = hash(hash(seed) ^ (2 * index + stream));
+	return float(h >> 8) * (1.f / 16777216.f);
+}
+
+// Mirrors border in particles.comp
+void border(unsigned policy, float& pos, float& vel, float side)
+{
+	if(policy == shader::borderWrap) {
+		// glsl mod, the result has the sign of the divisor
+		auto x = pos + 1.f;
+		pos = x - 2.f * std::floor(x / 2.f) - 1.f;
+	} else if(policy == shader::borderReflect) {
+		pos = std::clamp(2.f * side - pos, -1.f, 1.f);
+		vel = -vel;
+	} else if(policy == shader::borderClamp) {
+		pos = side;
+		vel = 0.f;
+	}
+}
+
+// Applies the border policy to the particles in [begin, end) after
+// they were moved, like the end of particles.comp.
+// Returns the number of particles inside [-1, 1]
+std::size_t applyBorders(const StepData& d, std::size_t begin, std::size_t end)
+{
+	std::size_t live = 0u;
+	for(auto i = begin; i < end; ++i) {
+		auto& x = d.posX[i];
+		auto& y = d.posY[i];
+		auto outside = std::abs(x) > 1.f || std::abs(y) > 1.f;
+		if(outside && d.border == shader::borderRespawn) {
+			auto index = std::uint32_t(i);
+			x = 2.f * randomFloat(d.frame, index, 0) - 1.f;
+			y = 2.f * randomFloat(d.frame, index, 1) - 1.f;
+			d.velX[i] = d.velY[i] = 0.f;
+		} else if(outside) {
+			if(x < -1.f || x > 1.f) {
+				border(d.border, x, d.velX[i], x < -1.f ? -1.f : 1.f);
+			}
+
+			if(y < -1.f || y > 1.f) {
+				border(d.border, y, d.velY[i], y < -1.f ? -1.f : 1.f);
+			}
+		}
+
+		live += (std::abs(x) <= 1.f && std::abs(y) <= 1.f);
+	}
+
+	return live;
+}
+
+// Mirrors separation in particles.comp.
+// Computes the velocity change of the particles in [begin, end)
+// from the positions in the spatial hash
+void separate(const StepData& d, std::size_t begin, std::size_t end)
+{
+	for(auto i = begin; i < end; ++i) {
+		auto x = d.posX[i];
+		auto y = d.posY[i];
+		auto cx = gridCell(x, d.radius);
+		auto cy = gridCell(y, d.radius);
+
+		std::uint32_t visited[9];
+		auto visitedCount = 0u;
+		auto fx = 0.f;
+		auto fy = 0.f;
+		for(auto oy = -1; oy <= 1; ++oy) {
+			for(auto ox = -1; ox <= 1; ++ox) {
+				auto hash = gridHash(cx + ox, cy + oy);
+				auto last = visited + visitedCount;
+				if(std::find(visited, last, hash) != last) {
+					continue;
+				}
+
+				visited[visitedCount++] = hash;
+				auto first = (hash == 0u) ? 0u : d.cellEnds[hash - 1];
+				for(auto c = first; c < d.cellEnds[hash]; ++c) {
+					auto dx = x - d.cellX[c];
+					auto dy = y - d.cellY[c];
+					auto dist = std::sqrt(dx * dx + dy * dy);
+					if(dist > 0.f && dist < d.radius) {
+						auto fac = 1.f - dist / d.radius;
+						fx += fac * (dx / dist);
+						fy += fac * (dy / dist);
+					}
+				}
+			}
+		}
+
+		d.forceX[i] = d.separation * fx;
+		d.forceY[i] = d.separation * fy;
+	}
+}
+
+// Mirrors main in particles.comp, keep them in sync.
+// The shader does not handle borders (yet), so neither do the kernels
+void simulateScalar(const StepData& d, std::size_t begin, std::size_t end)
+{
+	for(auto i = begin; i < end; ++i) {
+		auto x = d.posX[i];
+		auto y = d.posY[i];
+		auto vx = d.velX[i] * d.friction;
+		auto vy = d.velY[i] * d.friction;
+
+		for(auto a = 0u; a < d.attractorCount; ++a) {
+			auto dx = d.attractX[a] - x;
+			auto dy = d.attractY[a] - y;
+			auto invDist = 1.f / std::sqrt(dx * dx + dy * dy);
+			vx += d.fac * (dx * invDist);
+			vy += d.fac * (dy * invDist);
+		}
+
+		if(d.forceX) {
+			vx += d.forceX[i];
+			vy += d.forceY[i];
+		}
+
+		d.posX[i] = x + vx * d.delta;
+		d.posY[i] = y + vy * d.delta;
+		d.velX[i] = vx;
+		d.velY[i] = vy;
+	}
+}
+
+#ifdef PARTICLES_AVX2
+
+// no approximations (rsqrt) to stay close to the gpu results
+__attribute__((target("avx2")))
+void simulateAvx2(const StepData& d, std::size_t begin, std::size_t end)
+{
+	auto friction = _mm256_set1_ps(d.friction);
+	auto fac = _mm256_set1_ps(d.fac);
+	auto delta = _mm256_set1_ps(d.delta);
+	auto one = _mm256_set1_ps(1.f);
+
+	auto i = begin;
+	for(; i + 8 <= end; i += 8) {
+		auto x = _mm256_loadu_ps(d.posX + i);
+		auto y = _mm256_loadu_ps(d.posY + i);
+		auto vx = _mm256_mul_ps(_mm256_loadu_ps(d.velX + i), friction);
+		auto vy = _mm256_mul_ps(_mm256_loadu_ps(d.velY + i), friction);
+
+		for(auto a = 0u; a < d.attractorCount; ++a) {
+			auto dx = _mm256_sub_ps(_mm256_set1_ps(d.attractX[a]), x);
+			auto dy = _mm256_sub_ps(_mm256_set1_ps(d.attractY[a]), y);
+			auto dist2 = _mm256_add_ps(_mm256_mul_ps(dx, dx),
+				_mm256_mul_ps(dy, dy));
+			auto invDist = _mm256_div_ps(one, _mm256_sqrt_ps(dist2));
+			vx = _mm256_add_ps(vx, _mm256_mul_ps(fac, _mm256_mul_ps(dx, invDist)));
+			vy = _mm256_add_ps(vy, _mm256_mul_ps(fac, _mm256_mul_ps(dy, invDist)));
+		}
+
+		if(d.forceX) {
+			vx = _mm256_add_ps(vx, _mm256_loadu_ps(d.forceX + i));
+			vy = _mm256_add_ps(vy, _mm256_loadu_ps(d.forceY + i));
+		}
+
+		_mm256_storeu_ps(d.posX + i, _mm256_add_ps(x, _mm256_mul_ps(vx, delta)));
+		_mm256_storeu_ps(d.posY + i, _mm256_add_ps(y, _mm256_mul_ps(vy, delta)));
+		_mm256_storeu_ps(d.velX + i, vx);
+		_mm256_storeu_ps(d.velY + i, vy);
+	}
+
+	simulateScalar(d, i, end);
+}
+
+#endif // PARTICLES_AVX2
+
+#ifdef PARTICLES_NEON
+
+void simulateNeon(const StepData& d, std::size_t begin, std::size_t end)
+{
+	auto friction = vdupq_n_f32(d.friction);
+	auto fac = vdupq_n_f32(d.fac);
+	auto delta = vdupq_n_f32(d.delta);
+	auto one = vdupq_n_f32(1.f);
+
+	auto i = begin;
+	for(; i + 4 <= end; i += 4) {
+		auto x = vld1q_f32(d.posX + i);
+		auto y = vld1q_f32(d.posY + i);
+		auto vx = vmulq_f32(vld1q_f32(d.velX + i), friction);
+		auto vy = vmulq_f32(vld1q_f32(d.velY + i), friction);
+
+		for(auto a = 0u; a < d.attractorCount; ++a) {
+			auto dx = vsubq_f32(vdupq_n_f32(d.attractX[a]), x);
+			auto dy = vsubq_f32(vdupq_n_f32(d.attractY[a]), y);
+			auto dist2 = vaddq_f32(vmulq_f32(dx, dx), vmulq_f32(dy, dy));
+			auto invDist = vdivq_f32(one, vsqrtq_f32(dist2));
+			vx = vaddq_f32(vx, vmulq_f32(fac, vmulq_f32(dx, invDist)));
+			vy = vaddq_f32(vy, vmulq_f32(fac, vmulq_f32(dy, invDist)));
+		}
+
+		if(d.forceX) {
+			vx = vaddq_f32(vx, vld1q_f32(d.forceX + i));
+			vy = vaddq_f32(vy, vld1q_f32(d.forceY + i));
+		}
+
+		vst1q_f32(d.posX + i, vaddq_f32(x, vmulq_f32(vx, delta)));
+		vst1q_f32(d.posY + i, vaddq_f32(y, vmulq_f32(vy, delta)));
+		vst1q_f32(d.velX + i, vx);
+		vst1q_f32(d.velY + i, vy);
+	}
+
+	simulateScalar(d, i, end);
+}
+
+#endif // PARTICLES_NEON
+
+} // anon namespace
+
+CpuSimulation::CpuSimulation(unsigned int threads)
+{
+	threads_ = threads ? threads : std::thread::hardware_concurrency();
+	threads_ = std::max(threads_, 1u);
+
+#ifdef PARTICLES_AVX2
+	avx2_ = __builtin_cpu_supports("avx2");
+#endif
+
+	dlg_info("Cpu simulation: {} kernel, {} threads", kernel(), threads_);
+}
+
+void CpuSimulation::load(nytl::Span<const shader::Particle> particles)
+{
+	auto count = particles.size();
+	posX_.resize(count);
+	posY_.resize(count);
+	velX_.resize(count);
+	velY_.resize(count);
+
+	for(auto i = 0u; i < count; ++i) {
+		posX_[i] = particles[i].pos[0];
+		posY_[i] = particles[i].pos[1];
+		velX_[i] = particles[i].vel[0];
+		velY_[i] = particles[i].vel[1];
+	}
+}
+
+void CpuSimulation::store(nytl::Span<shader::Particle> particles) const
+{
+	dlg_assert(particles.size() >= size());
+	for(auto i = 0u; i < size(); ++i) {
+		particles[i].pos = {posX_[i], posY_[i]};
+		particles[i].vel = {velX_[i], velY_[i]};
+	}
+}
+
+std::vector<shader::Particle> CpuSimulation::store() const
+{
+	std::vector<shader::Particle> ret(size());
+	store(ret);
+	return ret;
+}
+
+void CpuSimulation::step(float delta, nytl::Span<const nytl::Vec2f> attractors)
+{
+	attractX_.resize(attractors.size());
+	attractY_.resize(attractors.size());
+	for(auto i = 0u; i < attractors.size(); ++i) {
+		attractX_[i] = attractors[i][0];
+		attractY_[i] = attractors[i][1];
+	}
+
+	auto count = std::max<std::size_t>(attractors.size(), 1u);
+
+	StepData data;
+	data.posX = posX_.data();
+	data.posY = posY_.data();
+	data.velX = velX_.data();
+	data.velY = velY_.data();
+	data.attractX = attractX_.data();
+	data.attractY = attractY_.data();
+	data.attractorCount = attractors.size();
+	data.delta = delta;
+	data.friction = 1 - shader::frictionFactor * delta;
+	data.fac = shader::attractionFactor * delta / std::sqrt(float(count));
+
+	data.forceX = data.forceY = nullptr;
+	auto interaction = interactionRadius_ > 0.f;
+	if(interaction) {
+		buildGrid();
+		forceX_.resize(size());
+		forceY_.resize(size());
+		data.forceX = forceX_.data();
+		data.forceY = forceY_.data();
+		data.cellX = cellX_.data();
+		data.cellY = cellY_.data();
+		data.cellEnds = cellEnds_.data();
+		data.radius = interactionRadius_;
+		data.separation = shader::separationFactor * delta;
+	}
+
+	data.border = borderPolicy_;
+	data.frame = frame_++;
+
+	Kernel kernel = simulateScalar;
+#ifdef PARTICLES_AVX2
+	if(avx2_ && !forceScalar_) {
+		kernel = simulateAvx2;
+	}
+#elif defined(PARTICLES_NEON)
+	if(!forceScalar_) {
+		kernel = simulateNeon;
+	}
+#endif
+
+	// chunks are multiples of the vector width so that only the
+	// last one has a scalar tail
+	auto threads = std::clamp<std::size_t>(size() / minParticlesPerThread,
+		1u, threads_);
+	auto chunk = (size() + threads - 1) / threads;
+	chunk = ((chunk + 7) / 8) * 8;
+
+	// the interaction only reads the positions in the spatial hash,
+	// so every chunk can be moved right after computing it
+	// live particles per chunk
+	std::vector<std::size_t> live(threads);
+	auto run = [&](std::size_t id, std::size_t begin, std::size_t end) {
+		if(interaction) {
+			separate(data, begin, end);
+		}
+
+		kernel(data, begin, end);
+		live[id] = applyBorders(data, begin, end);
+	};
+
+	std::vector<std::thread> workers;
+	workers.reserve(threads - 1);
+	auto id = std::size_t(1u);
+	for(auto begin = chunk; begin < size(); begin += chunk) {
+		auto end = std::min(begin + chunk, size());
+		workers.emplace_back(run, id++, begin, end);
+	}
+
+	run(0, 0, std::min(chunk, size()));
+	for(auto& worker : workers) {
+		worker.join();
+	}
+
+	live_ = 0u;
+	for(auto count : live) {
+		live_ += count;
+	}
+}
+
+void CpuSimulation::buildGrid()
+{
+	// mirrors grid.comp: count per bin, exclusive scan, scatter.
+	// Afterwards every bin holds the end of its range
+	hashes_.resize(size());
+	cellEnds_.assign(shader::gridHashSize, 0u);
+	for(auto i = 0u; i < size(); ++i) {
+		auto x = gridCell(posX_[i], interactionRadius_);
+		auto y = gridCell(posY_[i], interactionRadius_);
+		hashes_[i] = gridHash(x, y);
+		++cellEnds_[hashes_[i]];
+	}
+
+	auto sum = 0u;
+	for(auto& bin : cellEnds_) {
+		auto count = bin;
+		bin = sum;
+		sum += count;
+	}
+
+	cellX_.resize(size());
+	cellY_.resize(size());
+	for(auto i = 0u; i < size(); ++i) {
+		auto dst = cellEnds_[hashes_[i]]++;
+		cellX_[dst] = posX_[i];
+		cellY_[dst] = posY_[i];
+	}
+}
+
+const char* CpuSimulation::kernel() const
+{
+	if(forceScalar_) {
+		return "scalar";
+	}
+
+#ifdef PARTICLES_NEON
+	return "neon";
+#else
+	return avx2_ ? "avx2" : "scalar";
+#endif
+}
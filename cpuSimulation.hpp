@@ -0,0 +1,79 @@
+// Copyright (c) 2017 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+#include <shaders/particles.h> // shader::Particle
+#include <nytl/vec.hpp> // nytl::Vec2f
+#include <nytl/span.hpp> // nytl::Span
+
+#include <vector> // std::vector
+#include <cstdint> // std::uint32_t
+
+/// Cpu implementation of the simulation in particles.comp.
+/// Used as correctness reference for the gpu simulation and as
+/// throughput baseline. Does not depend on vulkan.
+/// Stores the particles as structure of arrays, uses AVX2 (if supported
+/// at runtime) or NEON kernels and distributes the particles across
+/// multiple threads.
+class CpuSimulation {
+public:
+	/// Zero threads uses one per hardware thread.
+	CpuSimulation(unsigned int threads = 0);
+
+	/// Replaces the current state with the given particles.
+	void load(nytl::Span<const shader::Particle>);
+
+	/// Writes the current state into the given span, which must have
+	/// at least size() elements.
+	void store(nytl::Span<shader::Particle>) const;
+	std::vector<shader::Particle> store() const;
+
+	/// Simulates one time step with the given attractor positions
+	/// in normalized device coordinates.
+	void step(float delta, nytl::Span<const nytl::Vec2f> attractors);
+
+	std::size_t size() const { return posX_.size(); }
+	unsigned int threads() const { return threads_; }
+
+	/// Radius of the particle interaction (separation), zero disables it.
+	/// The neighbours are found with the same spatial hash as on the gpu.
+	void interactionRadius(float radius) { interactionRadius_ = radius; }
+	float interactionRadius() const { return interactionRadius_; }
+
+	/// What happens to particles leaving [-1, 1], one of the border
+	/// constants in particles.h.
+	void borderPolicy(unsigned int policy) { borderPolicy_ = policy; }
+	unsigned int borderPolicy() const { return borderPolicy_; }
+
+	/// Number of particles inside [-1, 1] after the last step.
+	std::size_t live() const { return live_; }
+
+	/// Name of the kernel that is used, "avx2", "neon" or "scalar".
+	const char* kernel() const;
+
+	/// Uses the scalar kernel even if a vectorized one is available,
+	/// e.g. to compare them.
+	void forceScalar(bool force) { forceScalar_ = force; }
+
+protected:
+	std::vector<float> posX_, posY_;
+	std::vector<float> velX_, velY_;
+	std::vector<float> attractX_, attractY_;
+	unsigned int threads_ {};
+	bool avx2_ {};
+	bool forceScalar_ {};
+
+	// spatial hash, see grid.comp
+	void buildGrid();
+	float interactionRadius_ {};
+	std::vector<std::uint32_t> hashes_; // per particle
+	std::vector<std::uint32_t> cellEnds_; // per bin
+	std::vector<float> cellX_, cellY_; // positions sorted by bin
+	std::vector<float> forceX_, forceY_; // velocity change by interaction
+
+	unsigned int borderPolicy_ {};
+	std::uint32_t frame_ {}; // seeds the respawns
+	std::size_t live_ {};
+};
@@ -19,11 +19,56 @@
 #include <vpp/renderer.hpp> // vpp::SwapchainRenderer
 #include <vpp/debug.hpp> // vpp::DebugCallback
 
+#include <stats.hpp> // RollingStats
+#include <cpuSimulation.hpp> // CpuSimulation
 #include <dlg/dlg.hpp> // dlg
 
-#include <chrono>
+#include <chrono> // std::chrono
+#include <fstream> // std::ofstream
+#include <cmath> // std::cos
+#include <algorithm> // std::clamp
+#include <cstdio> // std::fputs
+#include <iterator> // std::size
+#include <thread> // std::this_thread
 using Clock = std::chrono::high_resolution_clock;
 
+// border policy names, indexed by the constants in particles.h
+constexpr const char* borderNames[] = {
+	"none", "wrap", "reflect", "clamp", "respawn"
+};
+static_assert(std::size(borderNames) == shader::borderRespawn + 1);
+
+const char* borderName(unsigned int border)
+{
+	return border < std::size(borderNames) ? borderNames[border] : "invalid";
+}
+
+// Throws std::invalid_argument for unknown names.
+unsigned int parseBorder(const std::string& name)
+{
+	for(auto i = 0u; i < std::size(borderNames); ++i) {
+		if(name == borderNames[i]) {
+			return i;
+		}
+	}
+
+	throw std::invalid_argument("unknown border policy " + name);
+}
+
+// Throws std::invalid_argument for unknown names.
+PresentMode parsePresentMode(const std::string& name)
+{
+	if(name == "mailbox") {
+		return PresentMode::mailbox;
+	} else if(name == "immediate") {
+		return PresentMode::immediate;
+	} else if(name == "fifo") {
+		return PresentMode::fifo;
+	}
+
+	throw std::invalid_argument("unknown present mode " + name);
+}
+
 struct Engine::Impl {
 	std::unique_ptr<ny::AppContext> appContext;
 	vpp::Instance instance;
@@ -35,28 +80,107 @@ struct Engine::Impl {
 	std::unique_ptr<Renderer> renderer {};
 };
 
-Engine::Engine()
+// Creates a device with a queue supporting graphics, compute and (if
+// a surface is given) presenting. Additionally creates a queue from
+// a compute-only family if there is one, used for async compute.
+// Prefers a discrete gpu but will also use software implementations
+// like lavapipe which makes it possible to run on machines without gpu.
+std::unique_ptr<vpp::Device> createDevice(vk::Instance ini,
+	vk::SurfaceKHR surface, const vpp::Queue*& queue,
+	const vpp::Queue*& computeQueue)
+{
+	auto phdevs = vk::enumeratePhysicalDevices(ini);
+	if(phdevs.empty()) {
+		throw std::runtime_error("Engine: no vulkan physical device found");
+	}
+
+	auto phdev = phdevs[0];
+	for(auto p : phdevs) {
+		auto props = vk::getPhysicalDeviceProperties(p);
+		if(props.deviceType == vk::PhysicalDeviceType::discreteGpu) {
+			phdev = p;
+			break;
+		}
+	}
+
+	auto family = -1;
+	auto computeFamily = -1;
+	auto qprops = vk::getPhysicalDeviceQueueFamilyProperties(phdev);
+	for(auto i = 0u; i < qprops.size(); ++i) {
+		auto graphics = bool(qprops[i].queueFlags & vk::QueueBits::graphics);
+		auto compute = bool(qprops[i].queueFlags & vk::QueueBits::compute);
+		auto present = !surface ||
+			vk::getPhysicalDeviceSurfaceSupportKHR(phdev, i, surface);
+
+		if(family == -1 && graphics && compute && present) {
+			family = i;
+		} else if(computeFamily == -1 && compute && !graphics) {
+			computeFamily = i;
+		}
+	}
+
+	if(family == -1) {
+		throw std::runtime_error("Engine: no graphics, compute and present queue");
+	}
+
+	float priority = 1.f;
+	vk::DeviceQueueCreateInfo queueInfos[2];
+	queueInfos[0].queueFamilyIndex = family;
+	queueInfos[0].queueCount = 1;
+	queueInfos[0].pQueuePriorities = &priority;
+
+	queueInfos[1].queueFamilyIndex = computeFamily;
+	queueInfos[1].queueCount = 1;
+	queueInfos[1].pQueuePriorities = &priority;
+
+	const char* extensions[] = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
+
+	vk::DeviceCreateInfo devInfo;
+	devInfo.queueCreateInfoCount = computeFamily == -1 ? 1 : 2;
+	devInfo.pQueueCreateInfos = queueInfos;
+	if(surface) {
+		devInfo.enabledExtensionCount = 1;
+		devInfo.ppEnabledExtensionNames = extensions;
+	}
+
+	auto props = vk::getPhysicalDeviceProperties(phdev);
+	dlg_info("Using device {}", props.deviceName.data());
+
+	auto dev = std::make_unique<vpp::Device>(ini, phdev, devInfo);
+	queue = dev->queue(family);
+	computeQueue = computeFamily == -1 ? nullptr : dev->queue(computeFamily);
+	return dev;
+}
+
+Engine::Engine(const EngineSettings& settings) : settings_(settings)
 {
 	// for now hardcoded stuff
-	constexpr auto startSize = nytl::Vec2ui{1100, 800};
 	constexpr auto useValidation = false; // TODO
-	constexpr auto startMsaa = vk::SampleCountBits::e1;
 	constexpr auto layerName = "VK_LAYER_LUNARG_standard_validation";
 
+	const auto startSize = settings_.size;
+	const auto startMsaa = static_cast<vk::SampleCountBits>(settings_.samples);
+
 	impl_ = std::make_unique<Impl>();
 
 	// ny backend and appContext
-	auto& backend = ny::Backend::choose();
-	if(!backend.vulkan()) {
-		throw std::runtime_error("Engine: ny backend has no vulkan support!");
-	}
+	// not needed in headless mode
+	std::vector<const char*> iniExtensions;
+	if(!settings_.headless) {
+		auto& backend = ny::Backend::choose();
+		if(!backend.vulkan()) {
+			throw std::runtime_error("Engine: ny backend has no vulkan support!");
+		}
 
-	impl_->appContext = backend.createAppContext();
+		impl_->appContext = backend.createAppContext();
+		iniExtensions = impl_->appContext->vulkanExtensions();
+	}
 
 	// vulkan init
 	// instance
-	auto iniExtensions = impl_->appContext->vulkanExtensions();
-	iniExtensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
+	if(!settings_.headless || useValidation) {
+		iniExtensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
+	}
 
 	vk::ApplicationInfo appInfo ("msaa-triangle", 1, "msaa-triangle", 1, VK_API_VERSION_1_0);
 	vk::InstanceCreateInfo instanceInfo;
@@ -86,6 +210,17 @@ Engine::Engine()
 		impl_->debugCallback = std::make_unique<vpp::DebugCallback>(impl_->instance);
 	}
 
+	// headless: no window, offscreen renderer
+	if(settings_.headless) {
+		const vpp::Queue* queue {};
+		const vpp::Queue* computeQueue {};
+		impl_->device = createDevice(impl_->instance, {}, queue, computeQueue);
+		impl_->renderer = std::make_unique<Renderer>(*impl_->device,
+			vk::Extent2D {startSize[0], startSize[1]}, startMsaa, *queue,
+			computeQueue, settings_.renderer);
+		return;
+	}
+
 	// init ny window
 	auto vkSurface = vk::SurfaceKHR {};
 	auto ws = ny::WindowSettings {};
@@ -99,10 +234,11 @@ Engine::Engine()
 	impl_->windowContext = impl_->appContext->createWindowContext(ws);
 
 	const vpp::Queue* presentQueue {};
-	impl_->device = std::make_unique<vpp::Device>(impl_->instance,
-		vkSurface, presentQueue);
+	const vpp::Queue* computeQueue {};
+	impl_->device = createDevice(impl_->instance, vkSurface, presentQueue,
+		computeQueue);
 	impl_->renderer = std::make_unique<Renderer>(*impl_->device,
-		vkSurface, startMsaa, *presentQueue);
+		vkSurface, startMsaa, *presentQueue, computeQueue, settings_.renderer);
 
 	impl_->windowListener.windowContext = impl_->windowContext.get();
 	impl_->windowListener.appContext = impl_->appContext.get();
@@ -120,6 +256,9 @@ void Engine::mainLoop()
 {
 	constexpr auto printFrames = true;
 
+	// frame time while there is no surface that paces the frames
+	constexpr auto surfacelessFrameTime = std::chrono::milliseconds(16);
+
 	using secf = std::chrono::duration<float, std::ratio<1, 1>>;
 
 	auto lastFrame = Clock::now();
@@ -128,22 +267,21 @@ void Engine::mainLoop()
 
 	run_ = true;
 
-	// TODO: to make this work on android an additional idle-check
-	// loop is needed. See other android-working implementations using ny and
-	// vpp for examples.
 	while(run_) {
+		// the input is sampled as late as possible, after waiting
+		// for the oldest frame in flight
+		renderer().waitFrame();
 		if(!impl_->appContext->pollEvents()) {
 			dlg_info("pollEvents returned false");
 			return;
 		}
 
-		// waiting on surface on android
-		// will be set/unset by a callback from ny
-		while(wait_) {
-			if(!impl_->appContext->waitEvents()) {
-				dlg_info("waitEvents return false");
-				return;
-			}
+		// no surface (e.g. android in the background, set and unset
+		// by the window listener) or a minimized window without
+		// swapchain. The simulation keeps running, at a limited rate
+		// since nothing is presented
+		if(wait_ || !renderer().presenting()) {
+			std::this_thread::sleep_until(lastFrame + surfacelessFrameTime);
 		}
 
 		auto now = Clock::now();
@@ -162,22 +300,349 @@ void Engine::mainLoop()
 		}
 
 		renderer().update(deltaCount);
-		renderer().renderBlock();
-
-		if(printFrames) {
-			++fpsCounter;
-			secCounter += deltaCount;
-			if(secCounter >= 1.f) {
-				dlg_info("{} fps", fpsCounter);
-				secCounter = 0.f;
-				fpsCounter = 0;
+		renderer().renderFrame();
+
+		++fpsCounter;
+		secCounter += deltaCount;
+		if(secCounter >= 1.f) {
+			if(printFrames) {
+				dlg_info("{} fps, {} of {} particles on screen", fpsCounter,
+					renderer().liveParticles(), renderer().particleCount());
+				if(renderer().cull()) {
+					dlg_info("{} particles culled", renderer().culledParticles());
+				}
+
+				auto& gpu = renderer().gpuStats();
+				if(gpu.compute.count()) {
+					dlg_info("gpu compute: min {} avg {} p99 {} ms", gpu.compute.min(),
+						gpu.compute.avg(), gpu.compute.percentile(0.99));
+					dlg_info("gpu draw: min {} avg {} p99 {} ms", gpu.draw.min(),
+						gpu.draw.avg(), gpu.draw.percentile(0.99));
+				}
+
+				if(gpu.sort.count()) {
+					dlg_info("gpu sort: min {} avg {} p99 {} ms", gpu.sort.min(),
+						gpu.sort.avg(), gpu.sort.percentile(0.99));
+				}
+
+				if(renderer().fixedStep() > 0.f) {
+					auto& steps = renderer().substepStats();
+					dlg_info("substeps per frame: avg {} max {}, gpu per "
+						"substep: avg {} p99 {} ms", steps.avg(), steps.max(),
+						gpu.substep.avg(), gpu.substep.percentile(0.99));
+				}
+
+				auto& latency = renderer().latency();
+				dlg_info("input to present queued: avg {} p99 {} ms, "
+					"to frame done: avg {} p99 {} ms", latency.queued.avg(),
+					latency.queued.percentile(0.99), latency.completed.avg(),
+					latency.completed.percentile(0.99));
+			}
+
+			if(settings_.targetFrameTime > 0.f) {
+				adaptParticleCount(1000.f * secCounter / fpsCounter);
 			}
+
+			secCounter = 0.f;
+			fpsCounter = 0;
 		}
 	}
 
 	dlg_info("Exiting main loop with grace");
 }
 
+void Engine::adaptParticleCount(float frameTime)
+{
+	constexpr auto minCount = 1024u;
+	constexpr auto maxCount = 1u << 26;
+	constexpr auto tolerance = 0.1f; // relative, no change below
+	constexpr auto maxFactor = 1.5f; // per adaption step
+
+	// prefer the gpu times since the frame time is usually limited by vsync.
+	// The stats are reset on every particle count change
+	auto& gpu = renderer().gpuStats();
+	if(gpu.compute.count() && gpu.draw.count()) {
+		frameTime = gpu.compute.avg() + gpu.draw.avg();
+	}
+
+	auto fac = settings_.targetFrameTime / frameTime;
+	if(std::abs(1.f - fac) < tolerance) {
+		return;
+	}
+
+	fac = std::clamp(fac, 1 / maxFactor, maxFactor);
+	auto count = static_cast<unsigned int>(fac * renderer().particleCount());
+	count = std::clamp(count, minCount, maxCount);
+	renderer().particleCount(count);
+}
+
+void Engine::benchmark()
+{
+	// the first frames are not representative (lazy allocations,
+	// pipeline compilation in the driver) and therefore not measured
+	constexpr auto warmupFrames = 10u;
+
+	using secd = std::chrono::duration<double, std::ratio<1, 1>>;
+
+	if(!renderer().headless()) {
+		throw std::logic_error("Engine::benchmark: only available in headless mode");
+	}
+
+	auto frames = settings_.frames;
+	auto delta = settings_.delta;
+
+	std::vector<FrameTimes> times;
+	times.reserve(frames);
+
+	dlg_info("Running benchmark: {} frames, {} particles, delta {}, {}, "
+		"work group size {}, {} attractors, {}, {} particles, {}, "
+		"sort interval {}, interaction radius {}, border {}, {} emitters, "
+		"culling {}, zoom {}, level of detail {}, fixed step {}",
+		frames, renderer().particleCount(), delta,
+		renderer().cpuSimulation() ? "cpu simulation" :
+			renderer().asyncCompute() ? "async compute" : "sync compute",
+		renderer().workGroupSize(), settings_.attractors,
+		renderer().pushConstants() ? "push constants" : "uniform buffer",
+		renderer().compactParticles() ? "compact" : "fp32",
+		renderer().splat() ? "splatting" : "rasterizing points",
+		renderer().sortInterval(), settings_.renderer.interactionRadius,
+		borderName(settings_.renderer.border), renderer().emitterCount(),
+		renderer().cull() ? "on" : "off", renderer().view().zoom,
+		renderer().lod() ? "on" : "off", renderer().fixedStep());
+
+	auto steps = 0u; // simulation steps of the measured frames
+	auto start = Clock::now();
+	for(auto i = 0u; i < warmupFrames + frames; ++i) {
+		if(i == warmupFrames) {
+			start = Clock::now();
+		}
+
+		scriptAttractors(i);
+		auto updateStart = Clock::now();
+		renderer().update(delta);
+		auto update = std::chrono::duration_cast<secd>(Clock::now() - updateStart);
+
+		auto frameTimes = renderer().renderOffscreen();
+		frameTimes.update = update.count();
+		if(i >= warmupFrames) {
+			times.push_back(frameTimes);
+			steps += renderer().substeps();
+		}
+	}
+
+	// with async compute the last frames might still be running
+	vk::deviceWaitIdle(vulkanDevice());
+	auto total = std::chrono::duration_cast<secd>(Clock::now() - start).count();
+
+	if(!settings_.benchOutput.empty()) {
+		std::ofstream out(settings_.benchOutput);
+		if(!out) {
+			dlg_error("Could not open benchmark output {}", settings_.benchOutput);
+		} else {
+			out << "frame,frame_ms,update_ms,submit_ms,compute_ms,draw_ms,"
+				"gpu_compute_ms,gpu_draw_ms,gpu_sort_ms\n";
+			for(auto i = 0u; i < times.size(); ++i) {
+				out << i << ","
+					<< 1000 * times[i].frame << ","
+					<< 1000 * times[i].update << ","
+					<< 1000 * times[i].submit << ","
+					<< 1000 * times[i].host.compute << ","
+					<< 1000 * times[i].host.draw << ","
+					<< 1000 * times[i].gpu.compute << ","
+					<< 1000 * times[i].gpu.draw << ","
+					<< 1000 * times[i].gpu.sort << "\n";
+			}
+		}
+	}
+
+	if(times.empty()) {
+		dlg_warn("Benchmark: no frames measured");
+		return;
+	}
+
+	// returns the average in milliseconds, -1 if not available
+	auto report = [&](const char* name, auto member) {
+		RollingStats stats(times.size());
+		for(auto& t : times) {
+			auto value = member(t);
+			if(value >= 0.0) {
+				stats.add(1000 * value);
+			}
+		}
+
+		if(stats.count() == 0) {
+			dlg_info("{}: not available", name);
+			return -1.0;
+		}
+
+		dlg_info("{}: min {} ms, avg {} ms, p99 {} ms, max {} ms",
+			name, stats.min(), stats.avg(), stats.percentile(0.99), stats.max());
+		return double(stats.avg());
+	};
+
+	report("frame (host)", [](auto& t) { return t.frame; });
+	report("update (host)", [](auto& t) { return t.update; });
+	report("submit compute (host)", [](auto& t) { return t.submit; });
+	report("compute (host)", [](auto& t) { return t.host.compute; });
+	report("draw (host)", [](auto& t) { return t.host.draw; });
+	auto gpuCompute = report("compute (gpu)", [](auto& t) { return t.gpu.compute; });
+	auto gpuDraw = report("draw (gpu)", [](auto& t) { return t.gpu.draw; });
+	if(renderer().sortInterval()) {
+		report("sort (gpu)", [](auto& t) { return t.gpu.sort; });
+	}
+
+	// with a fixed time step, frames run a varying number of
+	// simulation steps. The bandwidth is computed per step then
+	auto& gpuStats = renderer().gpuStats();
+	if(renderer().fixedStep() > 0.f) {
+		dlg_info("{} simulation steps, {} per frame", steps,
+			double(steps) / times.size());
+		if(gpuStats.substep.count()) {
+			dlg_info("compute per substep (gpu): avg {} ms, p99 {} ms",
+				gpuStats.substep.avg(), gpuStats.substep.percentile(0.99));
+			gpuCompute = gpuStats.substep.avg();
+		}
+	}
+
+	// the simulation reads and writes every particle once (and the render
+	// stream if enabled), the vertex input reads it once
+	auto count = double(renderer().particleCount());
+	auto particleBytes = renderer().particleSize() * count;
+	auto vertexBytes = renderer().vertexSize() * count;
+	auto simBytes = 2 * particleBytes;
+	if(renderer().renderStream()) {
+		simBytes += vertexBytes;
+	}
+
+	dlg_info("Particle format: {} bytes per particle, {} bytes vertex input, "
+		"{} MB particle traffic per frame", renderer().particleSize(),
+		renderer().vertexSize(), (simBytes + vertexBytes) / (1024 * 1024));
+	if(gpuCompute > 0.0) {
+		dlg_info("Simulation particle bandwidth: {} GB/s",
+			simBytes / (gpuCompute * 1e6));
+	}
+
+	if(gpuDraw > 0.0) {
+		dlg_info("Vertex input particle bandwidth: {} GB/s",
+			vertexBytes / (gpuDraw * 1e6));
+	}
+
+	auto particleSteps = double(renderer().particleCount()) * steps;
+	dlg_info("{} frames in {} s, {} fps, {} particles/s", times.size(), total,
+		times.size() / total, particleSteps / total);
+	dlg_info("{} of {} particles on screen at the end",
+		renderer().liveParticles(), renderer().particleCount());
+	if(renderer().cull()) {
+		dlg_info("{} particles culled at the end", renderer().culledParticles());
+	}
+}
+
+bool Engine::validate()
+{
+	// relative to the magnitude of the values, larger errors are reported.
+	// The attraction is not continuous at the attractors, so single
+	// particles very close to one can legitimately differ. A frame only
+	// fails if more than the given share of the particles does
+	constexpr auto tolerance = 1e-3f;
+	constexpr auto maxMismatchShare = 1e-3;
+
+	if(!renderer().headless()) {
+		throw std::logic_error("Engine::validate: only available in headless mode");
+	}
+
+	if(renderer().cpuSimulation()) {
+		throw std::logic_error("Engine::validate: needs the gpu simulation");
+	}
+
+	CpuSimulation cpu;
+	cpu.interactionRadius(settings_.renderer.interactionRadius);
+	cpu.borderPolicy(settings_.renderer.border);
+	cpu.load(renderer().readParticles());
+
+	dlg_info("Validating {} frames, {} particles, {} attractors",
+		settings_.frames, renderer().particleCount(), settings_.attractors);
+
+	auto differs = [&](float a, float b) {
+		auto scale = std::max(1.f, std::max(std::abs(a), std::abs(b)));
+		return std::abs(a - b) > tolerance * scale;
+	};
+
+	auto maxPosError = 0.f;
+	auto maxVelError = 0.f;
+	auto failedFrames = 0u;
+	auto outliers = 0u; // mismatches in frames that passed
+	for(auto i = 0u; i < settings_.frames; ++i) {
+		scriptAttractors(i);
+		renderer().update(settings_.delta);
+		renderer().renderOffscreen();
+		cpu.step(settings_.delta, renderer().attractors());
+
+		auto gpu = renderer().readParticles();
+		auto expected = cpu.store();
+
+		auto mismatches = 0u;
+		auto framePosError = 0.f;
+		auto frameVelError = 0.f;
+		for(auto p = 0u; p < gpu.size(); ++p) {
+			auto& g = gpu[p];
+			auto& e = expected[p];
+			for(auto c = 0u; c < 2; ++c) {
+				framePosError = std::max(framePosError, std::abs(g.pos[c] - e.pos[c]));
+				frameVelError = std::max(frameVelError, std::abs(g.vel[c] - e.vel[c]));
+			}
+
+			if(differs(g.pos[0], e.pos[0]) || differs(g.pos[1], e.pos[1]) ||
+					differs(g.vel[0], e.vel[0]) || differs(g.vel[1], e.vel[1])) {
+				++mismatches;
+			}
+		}
+
+		maxPosError = std::max(maxPosError, framePosError);
+		maxVelError = std::max(maxVelError, frameVelError);
+		if(mismatches > maxMismatchShare * gpu.size()) {
+			dlg_warn("Frame {}: {} of {} particles differ, max position "
+				"error {}, max velocity error {}", i, mismatches, gpu.size(),
+				framePosError, frameVelError);
+			++failedFrames;
+		} else {
+			outliers += mismatches;
+		}
+
+		// only compare single steps, errors would accumulate otherwise
+		cpu.load(gpu);
+	}
+
+	dlg_info("Max position error {}, max velocity error {}, {} outliers "
+		"in the passed frames", maxPosError, maxVelError, outliers);
+	if(failedFrames) {
+		dlg_error("Validation failed in {} of {} frames", failedFrames,
+			settings_.frames);
+		return false;
+	}
+
+	dlg_info("Validation passed");
+	return true;
+}
+
+void Engine::scriptAttractors(unsigned int frame)
+{
+	constexpr auto attractorRadius = 0.3f;
+	constexpr auto pi = 3.14159265359f;
+
+	// deterministic scripted input: attractors evenly spaced on
+	// a circle around the center, alternating in direction
+	auto size = nytl::Vec2f(settings_.size);
+	auto count = settings_.attractors;
+	renderer().points_.clear();
+	for(auto a = 0u; a < count; ++a) {
+		auto fac = (a % 2 == 0) ? 1.f : -1.f;
+		auto angle = fac * frame * settings_.delta + a * 2 * pi / count;
+		auto off = attractorRadius * nytl::Vec2f{std::cos(angle), std::sin(angle)};
+		auto ndc = nytl::Vec2f{0.5f + 0.5f * off[0], 0.5f + 0.5f * off[1]};
+		renderer().points_.push_back({ndc[0] * size[0], ndc[1] * size[1]});
+	}
+}
+
 // get functions
 ny::AppContext& Engine::appContext() const { return *impl_->appContext; }
 ny::WindowContext& Engine::windowContext() const { return *impl_->windowContext; }
@@ -186,8 +651,220 @@ vpp::Instance& Engine::vulkanInstance() const { return impl_->instance; }
 vpp::Device& Engine::vulkanDevice() const { return *impl_->device; }
 Renderer& Engine::renderer() const { return *impl_->renderer; }
 
-int main(int, char**)
+// Parses the command line into engine settings.
+// Throws std::invalid_argument on invalid arguments.
+EngineSettings parseSettings(int argc, char** argv)
 {
-	Engine engine;
-	engine.mainLoop();
+	EngineSettings ret;
+	auto value = [&](int& i) -> std::string {
+		if(i + 1 >= argc) {
+			throw std::invalid_argument(std::string("missing value for ") + argv[i]);
+		}
+
+		return argv[++i];
+	};
+
+	for(auto i = 1; i < argc; ++i) {
+		auto arg = std::string(argv[i]);
+		if(arg == "--headless") {
+			ret.headless = true;
+		} else if(arg == "--frames") {
+			ret.frames = std::stoul(value(i));
+		} else if(arg == "--delta") {
+			ret.delta = std::stof(value(i));
+		} else if(arg == "--samples") {
+			ret.samples = std::stoul(value(i));
+		} else if(arg == "--size") {
+			auto val = value(i);
+			auto x = val.find('x');
+			if(x == std::string::npos) {
+				throw std::invalid_argument("size must be given as <width>x<height>");
+			}
+
+			ret.size[0] = std::stoul(val.substr(0, x));
+			ret.size[1] = std::stoul(val.substr(x + 1));
+		} else if(arg == "--bench-output") {
+			ret.benchOutput = value(i);
+		} else if(arg == "--particles") {
+			ret.renderer.particleCount = std::stoul(value(i));
+		} else if(arg == "--seed") {
+			ret.renderer.seed = std::stoul(value(i));
+		} else if(arg == "--target-frame-time") {
+			ret.targetFrameTime = std::stof(value(i));
+		} else if(arg == "--async-compute") {
+			ret.renderer.asyncCompute = true;
+		} else if(arg == "--workgroup-size") {
+			ret.renderer.workGroupSize = std::stoul(value(i));
+		} else if(arg == "--retune") {
+			ret.renderer.retune = true;
+		} else if(arg == "--push-constants") {
+			ret.renderer.pushConstants = true;
+		} else if(arg == "--compact") {
+			ret.renderer.compactParticles = true;
+		} else if(arg == "--render-stream") {
+			ret.renderer.renderStream = true;
+		} else if(arg == "--interaction-radius") {
+			ret.renderer.interactionRadius = std::stof(value(i));
+		} else if(arg == "--border") {
+			ret.renderer.border = parseBorder(value(i));
+		} else if(arg == "--emitters") {
+			ret.renderer.emitters = std::stoul(value(i));
+		} else if(arg == "--emit-rate") {
+			ret.renderer.emitRate = std::stof(value(i));
+		} else if(arg == "--emit-speed") {
+			ret.renderer.emitSpeed = std::stof(value(i));
+		} else if(arg == "--lifetime") {
+			ret.renderer.lifetime = std::stof(value(i));
+		} else if(arg == "--cull") {
+			ret.renderer.cull = true;
+		} else if(arg == "--zoom") {
+			ret.renderer.zoom = std::stof(value(i));
+		} else if(arg == "--lod") {
+			ret.renderer.lod = true;
+		} else if(arg == "--sort-interval") {
+			ret.renderer.sortInterval = std::stoul(value(i));
+		} else if(arg == "--splat") {
+			ret.renderer.splat = true;
+		} else if(arg == "--fixed-step") {
+			ret.renderer.fixedStep = std::stof(value(i));
+		} else if(arg == "--max-substeps") {
+			ret.renderer.maxSubsteps = std::stoul(value(i));
+		} else if(arg == "--cpu-simulation") {
+			ret.renderer.cpuSimulation = true;
+		} else if(arg == "--validate") {
+			ret.headless = true;
+			ret.validate = true;
+		} else if(arg == "--attractors") {
+			ret.attractors = std::stoul(value(i));
+		} else if(arg == "--frames-in-flight") {
+			ret.renderer.framesInFlight = std::stoul(value(i));
+		} else if(arg == "--present-mode") {
+			ret.renderer.presentMode = parsePresentMode(value(i));
+		} else {
+			throw std::invalid_argument("unknown argument " + arg);
+		}
+	}
+
+	if(ret.attractors > shader::maxAttractors) {
+		throw std::invalid_argument("at most " +
+			std::to_string(shader::maxAttractors) + " attractors are supported");
+	}
+
+	if(ret.renderer.fixedStep < 0.f) {
+		throw std::invalid_argument("the fixed step must not be negative");
+	}
+
+	if(ret.renderer.maxSubsteps == 0) {
+		throw std::invalid_argument("at least one substep is needed");
+	}
+
+	if(ret.renderer.framesInFlight == 0) {
+		throw std::invalid_argument("at least one frame must be in flight");
+	}
+
+	if(ret.renderer.emitters > shader::maxEmitters) {
+		throw std::invalid_argument("at most " +
+			std::to_string(shader::maxEmitters) + " emitters are supported");
+	}
+
+	// sorting reorders the particles, they could no longer be
+	// compared with the cpu simulation
+	if(ret.validate && ret.renderer.sortInterval) {
+		dlg_warn("Not sorting the particles when validating");
+		ret.renderer.sortInterval = 0u;
+	}
+
+	// the cpu simulation is compared after every step
+	if(ret.validate && ret.renderer.fixedStep > 0.f) {
+		dlg_warn("Not using a fixed time step when validating");
+		ret.renderer.fixedStep = 0.f;
+	}
+
+	// the cpu simulation has no lifecycle
+	if(ret.validate && ret.renderer.emitters) {
+		dlg_warn("Not using emitters when validating");
+		ret.renderer.emitters = 0u;
+	}
+
+	// changing the pool size frees all particles
+	if(ret.renderer.emitters && ret.targetFrameTime > 0.f) {
+		dlg_warn("Not adapting the particle count with emitters");
+		ret.targetFrameTime = 0.f;
+	}
+
+	auto s = ret.samples;
+	if(s != 1 && s != 2 && s != 4 && s != 8) {
+		throw std::invalid_argument("samples must be one of 1, 2, 4, 8");
+	}
+
+	return ret;
+}
+
+constexpr auto usage =
+	"usage: particles [options]\n"
+	"  --help                  print this message\n"
+	"  --headless              render offscreen and run the benchmark\n"
+	"  --frames <n>            number of benchmark frames\n"
+	"  --delta <seconds>       fixed benchmark time step\n"
+	"  --samples <1|2|4|8>     initial multisample count\n"
+	"  --size <w>x<h>          window or offscreen target size\n"
+	"  --bench-output <file>   write per-frame times as csv\n"
+	"  --particles <n>         initial number of particles\n"
+	"  --seed <n>              seed for reproducible particle positions\n"
+	"  --target-frame-time <ms> adapt the particle count to this frame time\n"
+	"  --async-compute         simulate on a dedicated compute queue\n"
+	"  --workgroup-size <n>    simulation work group size, tuned if not given\n"
+	"  --retune                ignore the cached tuned work group size\n"
+	"  --push-constants        pass the frame data as push constants\n"
+	"  --attractors <n>        number of scripted benchmark attractors\n"
+	"  --compact               store particles in a compact 8 byte format\n"
+	"  --render-stream         draw from a packed 4 byte render stream\n"
+	"  --splat                 splat the particles with a compute shader\n"
+	"  --sort-interval <k>     sort the particles by screen tile every k frames\n"
+	"  --interaction-radius <r> let particles closer than r repel each other\n"
+	"  --border <policy>       none, wrap, reflect, clamp or respawn\n"
+	"  --emitters <n>          spawn particles with a lifetime from n emitters\n"
+	"  --emit-rate <r>         particles per second and emitter\n"
+	"  --emit-speed <v>        maximum initial particle speed\n"
+	"  --lifetime <s>          maximum particle lifetime in seconds\n"
+	"  --cull                  only draw the particles inside the screen\n"
+	"  --zoom <z>              initial zoom of the view\n"
+	"  --lod                   draw fewer particles when zoomed out\n"
+	"  --fixed-step <s>        simulate with a fixed time step\n"
+	"  --max-substeps <k>      simulation steps per frame at most (fixed step)\n"
+	"  --cpu-simulation        simulate on the cpu instead of the gpu\n"
+	"  --frames-in-flight <n>  frames submitted ahead of the gpu (window)\n"
+	"  --present-mode <mode>   mailbox, immediate or fifo\n"
+	"  --validate              compare the gpu against the cpu simulation\n";
+
+int main(int argc, char** argv)
+{
+	for(auto i = 1; i < argc; ++i) {
+		if(std::string(argv[i]) == "--help") {
+			std::fputs(usage, stdout);
+			return EXIT_SUCCESS;
+		}
+	}
+
+	EngineSettings settings;
+	try {
+		settings = parseSettings(argc, argv);
+	} catch(const std::exception& err) {
+		dlg_error("Invalid arguments: {}", err.what());
+		std::fputs(usage, stderr);
+		return EXIT_FAILURE;
+	}
+
+	auto start = Clock::now();
+	Engine engine(settings);
+	auto startup = std::chrono::duration<double, std::milli>(Clock::now() - start);
+	dlg_info("Startup took {} ms", startup.count());
+
+	if(settings.headless && settings.validate) {
+		return engine.validate() ? EXIT_SUCCESS : EXIT_FAILURE;
+	} else if(settings.headless) {
+		engine.benchmark();
+	} else {
+		engine.mainLoop();
+	}
 }
@@ -7,6 +7,9 @@
 #include <ny/fwd.hpp>
 #include <vpp/fwd.hpp>
 #include <nytl/vec.hpp>
+#include <settings.hpp> // EngineSettings
+
+#include <memory> // std::unique_ptr
 
 class Renderer;
 
@@ -15,7 +18,7 @@ class Renderer;
 /// Entrypoint class from the main function.
 class Engine {
 public:
-	Engine();
+	Engine(const EngineSettings& settings = {});
 	~Engine();
 
 	ny::AppContext& appContext() const;
@@ -25,11 +28,31 @@ public:
 	vpp::Device& vulkanDevice() const;
 
 	Renderer& renderer() const;
+	const EngineSettings& settings() const { return settings_; }
+
+	/// Runs the interactive main loop until the window is closed.
 	void mainLoop();
 
+	/// Runs settings().frames fixed-delta frames in headless mode and
+	/// reports the per-frame compute and draw times.
+	void benchmark();
+
+	/// Runs settings().frames frames in headless mode and compares the
+	/// gpu simulation after every frame against the cpu simulation,
+	/// started from the same state. Returns whether all frames matched.
+	bool validate();
+
+protected:
+	/// Scales the particle count to reach the target frame time.
+	void adaptParticleCount(float frameTime);
+
+	/// Sets the deterministic benchmark attractors for the given frame.
+	void scriptAttractors(unsigned int frame);
+
 protected:
 	struct Impl;
 	std::unique_ptr<Impl> impl_;
+	EngineSettings settings_;
 	bool run_ {true};
 	bool wait_ {false};
 };
@@ -0,0 +1,173 @@
+// Copyright (c) 2017 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#include <pipelineCache.hpp>
+#include <vpp/device.hpp> // vpp::Device
+#include <dlg/dlg.hpp> // dlg
+
+#include <sstream> // std::stringstream
+#include <iomanip> // std::setw
+#include <cstdlib> // std::getenv
+#include <cerrno> // errno
+
+#ifdef _WIN32
+	#include <direct.h> // _mkdir
+#else
+	#include <sys/stat.h> // mkdir
+#endif
+
+namespace {
+
+constexpr auto cacheDirName = "vulkan-particles";
+
+bool makeDirectory(const std::string& path)
+{
+#ifdef _WIN32
+	auto res = _mkdir(path.c_str());
+#else
+	auto res = mkdir(path.c_str(), 0755);
+#endif
+	return res == 0 || errno == EEXIST;
+}
+
+// Returns the directory for the cache files with a trailing slash,
+// created if needed. Empty (the working directory) if there is none,
+// e.g. on android
+std::string cacheDirectory()
+{
+	std::string base;
+#ifdef _WIN32
+	if(auto appData = std::getenv("LOCALAPPDATA")) {
+		base = appData;
+	}
+#else
+	if(auto xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg) {
+		base = xdg;
+	} else if(auto home = std::getenv("HOME"); home && *home) {
+		base = std::string(home) + "/.cache";
+		makeDirectory(base);
+	}
+#endif
+
+	if(base.empty()) {
+		return {};
+	}
+
+	auto dir = base + "/" + cacheDirName;
+	if(!makeDirectory(dir)) {
+		dlg_warn("Could not create cache directory {}", dir);
+		return {};
+	}
+
+	return dir + "/";
+}
+
+// The driver rejects cache data of other devices or driver versions
+// anyway, the name just keeps the caches of multiple ones apart
+std::string cacheFileName(const vk::PhysicalDeviceProperties& props)
+{
+	std::stringstream name;
+	name << "pipelines-" << std::hex << props.vendorID << "-"
+		<< props.deviceID << "-";
+	for(auto byte : props.pipelineCacheUUID) {
+		name << std::setw(2) << std::setfill('0') << unsigned(byte);
+	}
+
+	name << ".bin";
+	return name.str();
+}
+
+} // anon namespace
+
+PipelineCache::PipelineCache(const vpp::Device& dev)
+{
+	path_ = cacheDirectory() + cacheFileName(dev.properties());
+
+	try {
+		cache_ = vpp::PipelineCache(dev, path_);
+	} catch(const std::exception& err) {
+		dlg_warn("Could not load pipeline cache {}: {}", path_, err.what());
+		cache_ = vpp::PipelineCache(dev);
+	}
+
+	dlg_info("Pipeline cache: {}", path_);
+	thread_ = std::thread([this]{ run(); });
+}
+
+PipelineCache::~PipelineCache()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		exit_ = true;
+	}
+
+	cv_.notify_one();
+	thread_.join();
+}
+
+void PipelineCache::save()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		saveRequested_ = true;
+	}
+
+	cv_.notify_one();
+}
+
+void PipelineCache::enqueue(std::function<void()> task)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		tasks_.push_back(std::move(task));
+	}
+
+	cv_.notify_one();
+}
+
+void PipelineCache::run()
+{
+	while(true) {
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			cv_.wait(lock, [&]{
+				return exit_ || saveRequested_ || !tasks_.empty();
+			});
+
+			// the save waits for the tasks, so it includes the
+			// pipelines they create. On exit, only the save is done
+			if(!exit_ && !tasks_.empty()) {
+				task = std::move(tasks_.front());
+				tasks_.pop_front();
+			} else if(saveRequested_) {
+				saveRequested_ = false;
+			} else {
+				return;
+			}
+		}
+
+		if(!task) {
+			write();
+			continue;
+		}
+
+		try {
+			task();
+		} catch(const std::exception& err) {
+			dlg_warn("Pipeline cache task failed: {}", err.what());
+		}
+	}
+}
+
+void PipelineCache::write()
+{
+	// vkGetPipelineCacheData may run while other threads create
+	// pipelines with the cache
+	try {
+		vpp::save(cache_, path_);
+	} catch(const std::exception& err) {
+		dlg_warn("vpp::save(PipelineCache): {}", err.what());
+	}
+}
@@ -0,0 +1,59 @@
+// Copyright (c) 2017 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+#include <vpp/pipeline.hpp> // vpp::PipelineCache
+
+#include <string> // std::string
+#include <functional> // std::function
+#include <deque> // std::deque
+#include <mutex> // std::mutex
+#include <condition_variable> // std::condition_variable
+#include <thread> // std::thread
+
+/// Pipeline cache shared by all pipelines of a device.
+/// Stored per device and driver (pipelineCacheUUID) in the user cache
+/// directory, the working directory if there is none. Written to disk
+/// on a worker thread, which can also compile pipelines in advance.
+class PipelineCache {
+public:
+	/// Loads the cache of the given device. Starts empty if there is
+	/// none yet or it cannot be read.
+	PipelineCache(const vpp::Device&);
+
+	/// Finishes the running task and a requested save.
+	/// Queued tasks that did not start yet are dropped.
+	~PipelineCache();
+
+	PipelineCache(const PipelineCache&) = delete;
+	PipelineCache& operator=(const PipelineCache&) = delete;
+
+	/// Writes the cache to disk on the worker thread, after the queued
+	/// tasks. Requests until then are merged into one save.
+	void save();
+
+	/// Runs the given function on the worker thread, after the ones
+	/// queued before. Meant for creating pipelines that are not needed
+	/// yet, to fill the cache. Exceptions are logged.
+	void enqueue(std::function<void()>);
+
+	const std::string& path() const { return path_; }
+	const vpp::PipelineCache& cache() const { return cache_; }
+	operator vk::PipelineCache() const { return cache_; }
+
+protected:
+	void run();
+	void write();
+
+	vpp::PipelineCache cache_;
+	std::string path_;
+
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	std::deque<std::function<void()>> tasks_;
+	bool saveRequested_ {};
+	bool exit_ {};
+	std::thread thread_; // started last, uses the other members
+};
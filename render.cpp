@@ -14,26 +14,157 @@
 
 #include <dlg/dlg.hpp> // dlg
 #include <random>
+#include <chrono>
+#include <algorithm>
+#include <limits>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstring>
+#include <cmath>
+#include <functional>
+#include <numeric>
 
 // shader data
 #include <shaders/particles.frag.h>
 #include <shaders/particles.vert.h>
+#include <shaders/particles_stream.vert.h>
 #include <shaders/particles.comp.h>
-
-vpp::Pipeline createGraphicsPipeline(const vpp::Device&, vk::RenderPass,
-	vk::PipelineLayout, vk::SampleCountBits);
+#include <shaders/particles_push.comp.h>
+#include <shaders/particles_compact.comp.h>
+#include <shaders/particles_compact_push.comp.h>
+#include <shaders/init_compact.comp.h>
+#include <shaders/init.comp.h>
+#include <shaders/emit.comp.h>
+#include <shaders/emit_compact.comp.h>
+#include <shaders/splat.comp.h>
+#include <shaders/splat_compact.comp.h>
+#include <shaders/splat_stream.comp.h>
+#include <shaders/fullscreen.vert.h>
+#include <shaders/resolve.frag.h>
+#include <shaders/sort_count.comp.h>
+#include <shaders/sort_count_compact.comp.h>
+#include <shaders/sort_scan.comp.h>
+#include <shaders/sort_scatter.comp.h>
+#include <shaders/sort_scatter_compact.comp.h>
+#include <shaders/grid_count.comp.h>
+#include <shaders/grid_count_compact.comp.h>
+#include <shaders/grid_scatter.comp.h>
+#include <shaders/grid_scatter_compact.comp.h>
+
+using Clock = std::chrono::high_resolution_clock;
+using Particle = shader::Particle;
+
+vpp::Pipeline createGraphicsPipeline(const vpp::Device&, vk::PipelineCache,
+	bool compact, bool renderStream, vk::RenderPass, vk::PipelineLayout,
+	vk::SampleCountBits);
 vpp::Pipeline createComputePipeline(const vpp::Device& device,
-	vk::PipelineLayout layout);
+	vk::PipelineCache cache, vk::PipelineLayout layout,
+	nytl::Span<const std::uint32_t> spirv, unsigned int workGroupSize,
+	bool renderStream = false, bool interaction = false,
+	unsigned int border = shader::borderNone, bool lifecycle = false,
+	bool cull = false);
+vpp::Pipeline createResolvePipeline(const vpp::Device&, vk::PipelineCache,
+	vk::RenderPass, vk::PipelineLayout, vk::SampleCountBits);
 vpp::RenderPass createRenderPass(const vpp::Device&, vk::Format,
-	vk::SampleCountBits);
+	vk::SampleCountBits, vk::ImageLayout finalLayout);
+vpp::ViewableImage createColorTarget(const vpp::Device&, vk::Format,
+	vk::Extent2D, vk::SampleCountBits, vk::ImageUsageFlags);
+void particleBarrier(vk::CommandBuffer, vk::Buffer particles);
+
+// Creates a device local storage buffer. Shared concurrently between
+// the given queue families, only used by one if empty.
+vpp::Buffer createStorageBuffer(const vpp::Device&, vk::DeviceSize size,
+	vk::BufferUsageFlags usage = {},
+	nytl::Span<const std::uint32_t> families = {});
+
+// Records the given function into a command buffer and submits it.
+// Blocks until the submission has finished.
+void submitWait(const vpp::Queue&,
+	const std::function<void(vk::CommandBuffer)>& record);
+
+const char* presentModeName(vk::PresentModeKHR);
+
+// Equivalent to unpackParticle in particles.h.
+Particle unpack(const shader::CompactParticle&);
+
+// Flushes the given range of a non-coherent mapping, relative
+// to the start of the mapping. Aligns it to nonCoherentAtomSize.
+void flushMapped(const vpp::MemoryMapView&, vk::DeviceSize offset,
+	vk::DeviceSize size);
+
+constexpr auto neededUniformSize = sizeof(shader::FrameData);
+constexpr auto attractorsSize = shader::maxAttractors * sizeof(nytl::Vec2f);
+constexpr auto emittersSize = sizeof(shader::EmitHeader) +
+	shader::maxEmitters * sizeof(shader::Emitter);
+constexpr auto memoryType = 1; // -1 to just choose a suited one
+constexpr auto offscreenFormat = vk::Format::r8g8b8a8Unorm;
+constexpr auto maxTimingSlots = 8u; // more render buffers are not timed
+constexpr auto defaultWorkGroupSize = 64u; // if it cannot be tuned
+constexpr auto tuningFile = "workGroupSizes.txt";
+
+// number of uniform buffer slices, i.e. simulation frames that can be
+// in flight. Must be even (see recordCompute), frames in flight are
+// additionally limited by the swapchain image count
+constexpr auto uniformSlices = std::size_t(maxTimingSlots);
+static_assert(uniformSlices % 2 == 0);
+
+// Returns a string identifying the device and driver version.
+std::string deviceKey(const vk::PhysicalDeviceProperties& props)
+{
+	std::stringstream key;
+	key << std::hex << props.vendorID << ":" << props.deviceID << ":"
+		<< props.driverVersion << ":";
+	for(auto byte : props.pipelineCacheUUID) {
+		key << std::setw(2) << std::setfill('0') << unsigned(byte);
+	}
 
-struct Particle {
-	nytl::Vec2f pos;
-	nytl::Vec2f vel;
-};
+	return key.str();
+}
 
-constexpr auto neededUniformSize = (2 + 4 * 5) * 4;
-constexpr auto memoryType = 1; // -1 to just choose a suited one
+// The tuned work group sizes are stored as lines of
+// "<deviceKey> <size>" in the tuning file.
+// Returns 0 if there is no entry for the given device.
+unsigned int loadWorkGroupSize(const std::string& key)
+{
+	std::ifstream in(tuningFile);
+	std::string entryKey;
+	unsigned int size;
+	while(in >> entryKey >> size) {
+		if(entryKey == key) {
+			return size;
+		}
+	}
+
+	return 0u;
+}
+
+void storeWorkGroupSize(const std::string& key, unsigned int size)
+{
+	std::vector<std::pair<std::string, unsigned int>> entries;
+	{
+		std::ifstream in(tuningFile);
+		std::string entryKey;
+		unsigned int entrySize;
+		while(in >> entryKey >> entrySize) {
+			if(entryKey != key) {
+				entries.push_back({entryKey, entrySize});
+			}
+		}
+	}
+
+	entries.push_back({key, size});
+
+	std::ofstream out(tuningFile);
+	if(!out) {
+		dlg_warn("Could not write {}", tuningFile);
+		return;
+	}
+
+	for(auto& entry : entries) {
+		out << entry.first << " " << entry.second << "\n";
+	}
+}
 
 template<typename T>
 void write(std::byte*& ptr, T&& data) {
@@ -42,44 +173,265 @@ void write(std::byte*& ptr, T&& data) {
 }
 
 Renderer::Renderer(const vpp::Device& dev, vk::SurfaceKHR surface,
-	vk::SampleCountBits samples, const vpp::Queue& present)
+	vk::SampleCountBits samples, const vpp::Queue& present,
+	const vpp::Queue* compute, const RendererSettings& settings)
 {
 	// FIXME: size
+	settings_ = settings;
 	sampleCount_ = samples;
+	queue_ = &present;
+	particleCount_ = particleCapacity_ = std::max(settings.particleCount, 1u);
 	scInfo_ = vpp::swapchainCreateInfo(dev, surface, {800u, 500u});
+	choosePresentMode(surface);
+	surface_ = surface;
+
+	// the uniform buffer slices and the resources of the other slices
+	// are only guarded by the compute fences
+	auto inFlight = std::clamp<std::size_t>(settings.framesInFlight,
+		1u, uniformSlices);
+	if(inFlight != settings.framesInFlight) {
+		dlg_warn("Using {} frames in flight", inFlight);
+	}
+
+	// the frame slots are created with the render buffers,
+	// see fitFrameSlots
+	dlg_info("{} frames in flight, present mode {}", inFlight,
+		presentModeName(scInfo_.presentMode));
+
+	auto async = settings.asyncCompute && checkAsync(present, compute);
+	if(async) {
+		queueFamilies_ = {present.family(), compute->family()};
+	}
+
+	initResources(dev, present, scInfo_.imageFormat,
+		vk::ImageLayout::presentSrcKHR);
+	if(async) {
+		initAsync(dev, present, *compute);
+	}
+
+	initCompute(dev);
+	warmUpPipelines(dev, vk::ImageLayout::presentSrcKHR);
+
+	// init renderer
+	// with async compute the particle buffer to draw changes every frame
+	auto mode = async ? RecordMode::always : RecordMode::all;
+	vpp::DefaultRenderer::init(renderPass_, scInfo_, present, {}, mode);
+}
+
+Renderer::Renderer(const vpp::Device& dev, vk::Extent2D size,
+	vk::SampleCountBits samples, const vpp::Queue& queue,
+	const vpp::Queue* compute, const RendererSettings& settings)
+{
+	settings_ = settings;
+	sampleCount_ = samples;
+	queue_ = &queue;
+	particleCount_ = particleCapacity_ = std::max(settings.particleCount, 1u);
+	scInfo_.imageFormat = offscreenFormat;
+	scInfo_.imageExtent = size;
+
+	auto async = settings.asyncCompute && checkAsync(queue, compute);
+	if(async) {
+		queueFamilies_ = {queue.family(), compute->family()};
+	}
+
+	initResources(dev, queue, scInfo_.imageFormat,
+		vk::ImageLayout::colorAttachmentOptimal);
+	if(async) {
+		initAsync(dev, queue, *compute);
+	}
+
+	initCompute(dev);
+
+	// the sample count of the offscreen target never changes
+	initOffscreen(dev, queue, size);
+	pipelineCache_->save();
+}
+
+void Renderer::initResources(const vpp::Device& dev, const vpp::Queue& queue,
+	vk::Format format, vk::ImageLayout finalLayout)
+{
+	// all pipelines are created with the shared cache, written to
+	// disk in the background once they are (see the constructors)
+	pipelineCache_ = std::make_unique<PipelineCache>(dev);
+
+	auto supported = dev.properties().limits.framebufferColorSampleCounts;
+	if(!(supported & sampleCount_)) {
+		dlg_warn("{} samples not supported, not using multisampling",
+			static_cast<unsigned int>(sampleCount_));
+		sampleCount_ = vk::SampleCountBits::e1;
+	}
+
+	requestedSamples_ = sampleCount_;
+	sampleSwitch_ = std::make_unique<SampleSwitch>();
+	renderPass_ = createRenderPass(dev, format, sampleCount_, finalLayout);
+	initTimestamps(dev, queue);
+
+	pushConstants_ = settings_.pushConstants;
+	if(pushConstants_) {
+		dlg_info("Passing the frame data as push constants");
+	}
+
+	compact_ = settings_.compactParticles;
+	if(compact_ && settings_.cpuSimulation) {
+		dlg_warn("The cpu simulation needs the full particle format");
+		compact_ = false;
+	} else if(compact_) {
+		dlg_info("Using the compact particle format");
+	}
+
+	// the cpu simulation does not write a render stream
+	renderStream_ = settings_.renderStream && !settings_.cpuSimulation;
+	if(renderStream_) {
+		dlg_info("Drawing from a separate render stream");
+	}
+
+	interaction_ = settings_.interactionRadius > 0.f;
+	if(interaction_) {
+		dlg_info("Particle interaction radius: {}", settings_.interactionRadius);
+	}
+
+	lifecycle_ = settings_.emitters > 0;
+	if(lifecycle_ && settings_.cpuSimulation) {
+		dlg_warn("The cpu simulation does not support emitters");
+		lifecycle_ = false;
+	} else if(lifecycle_) {
+		dlg_info("{} emitters, {} particles/s each, speed {}, lifetime {} s",
+			settings_.emitters, settings_.emitRate, settings_.emitSpeed,
+			settings_.lifetime);
+
+		// evenly spaced on a circle around the center
+		constexpr auto pi = 3.14159265359f;
+		constexpr auto radius = 0.5f;
+		for(auto i = 0u; i < settings_.emitters; ++i) {
+			auto angle = i * 2 * pi / settings_.emitters;
+			emitters_.push_back({radius * std::cos(angle),
+				radius * std::sin(angle)});
+		}
+	}
+
+	cull_ = settings_.cull;
+	if(cull_ && settings_.cpuSimulation) {
+		dlg_warn("The cpu simulation does not support culling");
+		cull_ = false;
+	} else if(cull_) {
+		dlg_info("Culling the particles outside the screen");
+	}
+
+	view_.zoom = std::clamp(settings_.zoom, shader::minZoom, shader::maxZoom);
+	lod_ = settings_.lod;
+	if(lod_ && settings_.cpuSimulation) {
+		dlg_warn("The cpu simulation does not support the level of detail");
+		lod_ = false;
+	}
 
-	renderPass_ = createRenderPass(dev, scInfo_.imageFormat, samples);
+	view_.drawFraction = lod_ ? std::min(view_.zoom * view_.zoom, 1.f) : 1.f;
+
+	// the command buffers for every number of substeps are
+	// recorded in advance, see initCompute
+	fixedStep_ = std::max(settings_.fixedStep, 0.f);
+	if(fixedStep_ > 0.f) {
+		maxSubsteps_ = std::max(settings_.maxSubsteps, 1u);
+		dlg_info("Fixed time step of {} s, at most {} substeps per frame",
+			fixedStep_, maxSubsteps_);
+	}
 
 	// descriptor
-	vk::DescriptorPoolSize typeCounts[2] {};
+	// one set for simulating in place, three for async compute,
+	// one for initialization, two for splatting, one for resolving,
+	// two for sorting, two for the spatial hash, two for emitting
+	// and one for the draw data
+	vk::DescriptorPoolSize typeCounts[4] {};
 	typeCounts[0].type = vk::DescriptorType::storageBuffer;
-	typeCounts[0].descriptorCount = 1;
+	typeCounts[0].descriptorCount = 4 * 9 + 1 + 2 * 2 + 1 + 2 * 3 + 2 * 3 +
+		2 * 5;
+
+	typeCounts[1].type = vk::DescriptorType::storageBufferDynamic;
+	typeCounts[1].descriptorCount = 4 + 2;
+
+	typeCounts[2].type = vk::DescriptorType::uniformBuffer;
+	typeCounts[2].descriptorCount = 1 + 2;
 
-	typeCounts[1].type = vk::DescriptorType::uniformBuffer;
-	typeCounts[1].descriptorCount = 1;
+	typeCounts[3].type = vk::DescriptorType::uniformBufferDynamic;
+	typeCounts[3].descriptorCount = 4;
 
 	vk::DescriptorPoolCreateInfo descriptorPoolInfo;
-	descriptorPoolInfo.poolSizeCount = (pushConstants_) ? 1 : 2;
+	descriptorPoolInfo.poolSizeCount = (pushConstants_) ? 3 : 4;
 	descriptorPoolInfo.pPoolSizes = typeCounts;
-	descriptorPoolInfo.maxSets = 1;
+	descriptorPoolInfo.maxSets = 15;
 
 	descriptorPool_ = {dev, descriptorPoolInfo};
 
-	gfxPipelineLayout_ = {dev, {}, {}};
-	gfxPipeline_ = createGraphicsPipeline(dev, renderPass_,
-		gfxPipelineLayout_, sampleCount_);
+	// view and extrapolation, see particles.vert. Only written by
+	// transfers on the graphics queue
+	vk::BufferCreateInfo drawDataInfo;
+	drawDataInfo.usage = vk::BufferUsageBits::uniformBuffer |
+		vk::BufferUsageBits::transferDst;
+	drawDataInfo.size = sizeof(shader::DrawData);
+	drawDataBuffer_ = {dev, drawDataInfo,
+		dev.memoryTypeBits(vk::MemoryPropertyBits::deviceLocal)};
+	drawDataBuffer_.ensureMemory();
+
+	drawDescriptorLayout_ = {dev, {
+		vpp::descriptorBinding(
+			vk::DescriptorType::uniformBuffer,
+			vk::ShaderStageBits::vertex, 0)
+	}};
+	drawDescriptor_ = {drawDescriptorLayout_, descriptorPool_};
+	{
+		vpp::DescriptorSetUpdate update(drawDescriptor_);
+		update.uniform({{drawDataBuffer_, 0, sizeof(shader::DrawData)}});
+	}
 
-	auto compBindings = {
+	vk::PipelineLayoutCreateInfo gfxLayoutInfo;
+	gfxLayoutInfo.setLayoutCount = 1;
+	gfxLayoutInfo.pSetLayouts = &drawDescriptorLayout_.vkHandle();
+	gfxPipelineLayout_ = {dev, gfxLayoutInfo};
+	gfxPipeline_ = createGraphicsPipeline(dev, *pipelineCache_, compact_,
+		renderStream_, renderPass_, gfxPipelineLayout_, sampleCount_);
+
+	// input particles, ubo, output particles, attractors, render stream,
+	// spatial hash positions and bins, live counters, lifetimes,
+	// free list, alive list
+	std::vector<vk::DescriptorSetLayoutBinding> compBindings = {
 		vpp::descriptorBinding(
 			vk::DescriptorType::storageBuffer,
 			vk::ShaderStageBits::compute, 0),
 		vpp::descriptorBinding(
-			vk::DescriptorType::uniformBuffer,
-			vk::ShaderStageBits::compute, 1)
+			vk::DescriptorType::storageBuffer,
+			vk::ShaderStageBits::compute, 2),
+		vpp::descriptorBinding(
+			vk::DescriptorType::storageBufferDynamic,
+			vk::ShaderStageBits::compute, 3),
+		vpp::descriptorBinding(
+			vk::DescriptorType::storageBuffer,
+			vk::ShaderStageBits::compute, 4),
+		vpp::descriptorBinding(
+			vk::DescriptorType::storageBuffer,
+			vk::ShaderStageBits::compute, 5),
+		vpp::descriptorBinding(
+			vk::DescriptorType::storageBuffer,
+			vk::ShaderStageBits::compute, 6),
+		vpp::descriptorBinding(
+			vk::DescriptorType::storageBuffer,
+			vk::ShaderStageBits::compute, 7),
+		vpp::descriptorBinding(
+			vk::DescriptorType::storageBuffer,
+			vk::ShaderStageBits::compute, 8),
+		vpp::descriptorBinding(
+			vk::DescriptorType::storageBuffer,
+			vk::ShaderStageBits::compute, 9),
+		vpp::descriptorBinding(
+			vk::DescriptorType::storageBuffer,
+			vk::ShaderStageBits::compute, 10)
 	};
 
-	std::size_t count = (pushConstants_) ? 1 : 2;
-	compDescriptorLayout_ = {dev, {compBindings.begin(), count}};
+	if(!pushConstants_) {
+		compBindings.push_back(vpp::descriptorBinding(
+			vk::DescriptorType::uniformBufferDynamic,
+			vk::ShaderStageBits::compute, 1));
+	}
+
+	compDescriptorLayout_ = {dev, compBindings};
 	compDescriptor_ = {compDescriptorLayout_, descriptorPool_};
 
 	vk::PipelineLayoutCreateInfo computeLayoutInfo;
@@ -97,221 +449,2921 @@ Renderer::Renderer(const vpp::Device& dev, vk::SurfaceKHR surface,
 	}
 
 	compPipelineLayout_ = {dev, computeLayoutInfo};
-	compPipeline_ = createComputePipeline(dev, compPipelineLayout_);
 
 	// buffer
+	particleBuffer_ = createParticleBuffer(dev);
+	if(renderStream_) {
+		streamBuffer_ = createStreamBuffer(dev);
+	}
+
+	// the spatial hash is rebuilt before every simulation step
+	if(interaction_) {
+		cellBuffer_ = createStorageBuffer(dev,
+			particleCapacity_ * sizeof(nytl::Vec2f));
+		cellEndBuffer_ = createStorageBuffer(dev,
+			shader::gridHashSize * sizeof(std::uint32_t),
+			vk::BufferUsageBits::transferDst);
+	}
+
+	// the lifetimes and free list are only accessed by the simulation
+	// and emit pass. The alive list holds the draw command
+	if(lifecycle_) {
+		lifetimeBuffer_ = createStorageBuffer(dev,
+			particleCapacity_ * sizeof(float),
+			vk::BufferUsageBits::transferDst, queueFamilies_);
+		freeListBuffer_ = createStorageBuffer(dev,
+			(particleCapacity_ + 1) * sizeof(std::uint32_t),
+			vk::BufferUsageBits::transferDst, queueFamilies_);
+	}
+
+	aliveBuffer_ = createAliveBuffer(dev);
+
+	// one uniform buffer slice per frame that can be in flight.
+	// Stays mapped for the whole lifetime
+	vk::BufferCreateInfo bufInfo;
+	if(!pushConstants_) {
+		auto& limits = dev.properties().limits;
+		auto align = std::max(limits.minUniformBufferOffsetAlignment,
+			limits.nonCoherentAtomSize);
+		uboSliceSize_ = ((neededUniformSize + align - 1) / align) * align;
+
+		bufInfo.usage = vk::BufferUsageBits::uniformBuffer;
+		bufInfo.size = uniformSlices * uboSliceSize_;
+		auto mem = dev.memoryTypeBits(vk::MemoryPropertyBits::hostVisible);
+
+		compUbo_ = {dev, bufInfo, mem};
+		compUbo_.ensureMemory();
+		uboMap_ = compUbo_.memoryMap();
+	}
+
+	// the attractors are a ring of slices as well
+	auto& limits = dev.properties().limits;
+	auto align = std::max(limits.minStorageBufferOffsetAlignment,
+		limits.nonCoherentAtomSize);
+	attractorSliceSize_ = ((attractorsSize + align - 1) / align) * align;
+
+	bufInfo.usage = vk::BufferUsageBits::storageBuffer;
+	bufInfo.size = uniformSlices * attractorSliceSize_;
+	auto mem = dev.memoryTypeBits(vk::MemoryPropertyBits::hostVisible);
+	attractorBuffer_ = {dev, bufInfo, mem};
+	attractorBuffer_.ensureMemory();
+	attractorMap_ = attractorBuffer_.memoryMap();
+
+	// live and culled particle counters, one set per slice. Cleared by
+	// the simulation (see recordCompute), read back in update when the
+	// slice is reused
+	bufInfo.usage |= vk::BufferUsageBits::transferDst;
+	bufInfo.size = uniformSlices * sizeof(shader::FrameCounters);
+	liveBuffer_ = {dev, bufInfo, mem};
+	liveBuffer_.ensureMemory();
+	liveMap_ = liveBuffer_.memoryMap();
+
+	// group counts of the indirect simulation dispatch, one per slice.
+	// Written in update, so the recorded command buffers never depend
+	// on the particle count. Storage usage so compute passes could
+	// produce them as well
+	dispatchSliceSize_ = ((sizeof(vk::DispatchIndirectCommand) + align - 1) /
+		align) * align;
+	bufInfo.usage = vk::BufferUsageBits::storageBuffer |
+		vk::BufferUsageBits::indirectBuffer;
+	bufInfo.size = uniformSlices * dispatchSliceSize_;
+	dispatchBuffer_ = {dev, bufInfo, mem};
+	dispatchBuffer_.ensureMemory();
+	dispatchMap_ = dispatchBuffer_.memoryMap();
+
+	// the emitters of every frame, with the indirect dispatch of
+	// the emit pass in the header. Written in update
+	if(lifecycle_) {
+		emitterSliceSize_ = ((emittersSize + align - 1) / align) * align;
+		bufInfo.usage = vk::BufferUsageBits::storageBuffer |
+			vk::BufferUsageBits::indirectBuffer;
+		bufInfo.size = uniformSlices * emitterSliceSize_;
+		emitterBuffer_ = {dev, bufInfo, mem};
+		emitterBuffer_.ensureMemory();
+		emitterMap_ = emitterBuffer_.memoryMap();
+	}
+
+	// write descriptor
+	writeCompDescriptors();
+
+	// compute pipeline
+	// tuning the work group size needs the other resources. It writes
+	// the draw command, so the alive lists are initialized afterwards
+	workGroupSize_ = chooseWorkGroupSize(dev, queue);
+	initAliveLists();
+	compPipeline_ = createComputePipeline(dev, *pipelineCache_,
+		compPipelineLayout_, compShader(), workGroupSize_, renderStream_,
+		interaction_, settings_.border, lifecycle_, cull_);
+
+	// particle initialization
+	auto initBinding = vpp::descriptorBinding(
+		vk::DescriptorType::storageBuffer,
+		vk::ShaderStageBits::compute, 0);
+	initDescriptorLayout_ = {dev, {initBinding}};
+	initDescriptor_ = {initDescriptorLayout_, descriptorPool_};
+
+	vk::PushConstantRange initRange;
+	initRange.stageFlags = vk::ShaderStageBits::compute;
+	initRange.size = sizeof(std::uint32_t) * 3;
+
+	vk::PipelineLayoutCreateInfo initLayoutInfo;
+	initLayoutInfo.setLayoutCount = 1;
+	initLayoutInfo.pSetLayouts = &initDescriptorLayout_.vkHandle();
+	initLayoutInfo.pushConstantRangeCount = 1;
+	initLayoutInfo.pPushConstantRanges = &initRange;
+
+	initPipelineLayout_ = {dev, initLayoutInfo};
+	auto initShader = nytl::Span<const std::uint32_t>(init_comp_data);
+	if(compact_) {
+		initShader = init_compact_comp_data;
+	}
+
+	initPipeline_ = createComputePipeline(dev, *pipelineCache_,
+		initPipelineLayout_, initShader, workGroupSize_);
+
+	initSplat(dev);
+	initSort(dev);
+	initGrid(dev);
+	initEmit(dev);
+
+	seed_ = settings_.seed;
+	if(!seed_) {
+		seed_ = std::random_device{}();
+	}
+
+	dlg_info("Particle seed: {}", seed_);
+	initParticles(particleBuffer_, 0, particleCount_);
+	liveParticles_ = particleCount_; // until the first count is read
+
+	// the gpu initialization is used for the cpu simulation as well,
+	// this way both start with the same particles for a given seed
+	if(settings_.cpuSimulation) {
+		cpuSim_ = std::make_unique<CpuSimulation>();
+		cpuSim_->interactionRadius(settings_.interactionRadius);
+		cpuSim_->borderPolicy(settings_.border);
+		cpuSim_->load(readParticles());
+	}
+}
+
+void Renderer::initParticles(const vpp::Buffer& dst, unsigned int first,
+	unsigned int count)
+{
+	auto& dev = dst.device();
+	auto start = Clock::now();
+
+	{
+		vpp::DescriptorSetUpdate update(initDescriptor_);
+		update.storage({{dst, 0, vk::wholeSize}});
+	}
+
+	// a single dispatch is limited in the number of work groups
+	auto& limits = dev.properties().limits;
+	auto maxGroups = std::min(limits.maxComputeWorkGroupCount[0],
+		UINT32_MAX / workGroupSize_);
+	auto chunk = maxGroups * workGroupSize_;
+
+	submitWait(*queue_, [&](vk::CommandBuffer cmdBuf) {
+		vk::cmdBindPipeline(cmdBuf, vk::PipelineBindPoint::compute, initPipeline_);
+		vk::cmdBindDescriptorSets(cmdBuf, vk::PipelineBindPoint::compute,
+			initPipelineLayout_, 0, {initDescriptor_}, {});
+		for(auto off = 0u; off < count; off += chunk) {
+			std::uint32_t range[3] = {first + off, std::min(chunk, count - off),
+				seed_};
+			vk::cmdPushConstants(cmdBuf, initPipelineLayout_,
+				vk::ShaderStageBits::compute, 0, sizeof(range), range);
+
+			auto groups = (range[1] + workGroupSize_ - 1) / workGroupSize_;
+			vk::cmdDispatch(cmdBuf, groups, 1, 1);
+		}
+	});
+
+	auto ms = std::chrono::duration<double, std::milli>(Clock::now() - start);
+	dlg_info("Initialized {} particles in {} ms", count, ms.count());
+}
+
+void Renderer::particleCount(unsigned int count)
+{
+	count = std::max(count, 1u);
+	if(count == particleCount_) {
+		return;
+	}
+
+	dlg_info("Changing particle count from {} to {}", particleCount_, count);
+
+	auto& dev = queue_->device();
+	vk::deviceWaitIdle(dev);
+
+	auto oldCount = particleCount_;
+	auto keep = std::min(oldCount, count);
+	particleCount_ = count;
+
+	// only reallocate if the buffers are too small or way too large.
+	// The latest state is always moved into particleBuffer_
+	auto& latest = drawBuffer();
+	auto realloc = count > particleCapacity_ || count < particleCapacity_ / 2;
+	if(realloc) {
+		particleCapacity_ = count;
+		auto buf = createParticleBuffer(dev);
+		submitWait(*queue_, [&](vk::CommandBuffer cmdBuf) {
+			vk::cmdCopyBuffer(cmdBuf, latest, buf,
+				{{0, 0, particleSize() * keep}});
+		});
+
+		particleBuffer_ = std::move(buf);
+		if(async_) {
+			async_->particleBuffer = createParticleBuffer(dev);
+		}
+
+		if(sortInterval_) {
+			sortBuffer_ = createParticleBuffer(dev);
+		}
+
+		if(interaction_) {
+			cellBuffer_ = createStorageBuffer(dev,
+				particleCapacity_ * sizeof(nytl::Vec2f));
+		}
+
+		if(lifecycle_) {
+			lifetimeBuffer_ = createStorageBuffer(dev,
+				particleCapacity_ * sizeof(float),
+				vk::BufferUsageBits::transferDst, queueFamilies_);
+			freeListBuffer_ = createStorageBuffer(dev,
+				(particleCapacity_ + 1) * sizeof(std::uint32_t),
+				vk::BufferUsageBits::transferDst, queueFamilies_);
+		}
+
+		// otherwise it only holds the draw command
+		if(indexedDraw()) {
+			aliveBuffer_ = createAliveBuffer(dev);
+			if(async_) {
+				async_->aliveBuffer = createAliveBuffer(dev);
+			}
+		}
+
+		// rewritten by the next simulation step
+		if(renderStream_) {
+			streamBuffer_ = createStreamBuffer(dev);
+			if(async_) {
+				async_->streamBuffer = createStreamBuffer(dev);
+			}
+		}
+	} else if(&latest != &particleBuffer_) {
+		submitWait(*queue_, [&](vk::CommandBuffer cmdBuf) {
+			vk::cmdCopyBuffer(cmdBuf, latest, particleBuffer_,
+				{{0, 0, particleSize() * keep}});
+		});
+	}
+
+	if(count > oldCount) {
+		initParticles(particleBuffer_, oldCount, count - oldCount);
+	}
+
+	if(cpuSim_) {
+		cpuSim_->load(readParticles());
+	}
+
+	// the free list would have to be rebuilt from the lifetimes,
+	// just start over. Resets the draw commands for the cpu simulation
+	initAliveLists();
+
+	// the device is idle but the semaphores signaled by the last
+	// frames were never waited upon, just recreate them
+	if(async_) {
+		async_->current = 0u;
+		for(auto i = 0u; i < 2u; ++i) {
+			async_->bufferUsed[i] = false;
+			async_->bufferFree[i] = {dev};
+		}
+	}
+
+	// the descriptors bind the whole buffers, the simulation dispatch and
+	// the draws are indirect. Only the passes dispatched in chunks
+	// (see dispatchChunks) record the particle count
+	if(realloc) {
+		writeCompDescriptors();
+		writeSplatDescriptors();
+		writeSortDescriptors();
+		writeGridDescriptors();
+		writeEmitDescriptors();
+	}
+
+	if(realloc || sortInterval_ || interaction_) {
+		recordCompute();
+	}
+
+	// async compute relies on the simulation into buffer 1 in frame 0
+	frame_ = 0u;
+
+	// old timings are no longer representative
+	gpuStats_.compute.clear();
+	gpuStats_.draw.clear();
+	gpuStats_.sort.clear();
+
+	if(!realloc && !splat_) {
+		return;
+	}
+
+	// the device is idle, finishing the frames only resets their fences
+	if(headless()) {
+		recordOffscreen();
+	} else {
+		finishFrames();
+		invalidate();
+	}
+}
+
+vpp::Buffer Renderer::createParticleBuffer(const vpp::Device& dev) const
+{
 	vk::BufferCreateInfo bufInfo;
 	bufInfo.usage = vk::BufferUsageBits::vertexBuffer
 		| vk::BufferUsageBits::storageBuffer
+		| vk::BufferUsageBits::transferSrc
 		| vk::BufferUsageBits::transferDst;
-	bufInfo.size = sizeof(Particle) * particleCount_;
+	bufInfo.size = particleSize() * particleCapacity_;
+
+	// async compute accesses the particles from both queue families
+	if(!queueFamilies_.empty()) {
+		bufInfo.sharingMode = vk::SharingMode::concurrent;
+		bufInfo.queueFamilyIndexCount = queueFamilies_.size();
+		bufInfo.pQueueFamilyIndices = queueFamilies_.data();
+	}
+
+	// the cpu simulation writes the particles directly
 	auto mem = memoryType;
 	auto bits = dev.memoryTypeBits(vk::MemoryPropertyBits::deviceLocal);
-	if(memoryType == -1 || !(bits & (1 << memoryType))) {
+	if(settings_.cpuSimulation) {
+		mem = dev.memoryTypeBits(vk::MemoryPropertyBits::hostVisible);
+	} else if(memoryType == -1 || !(bits & (1 << memoryType))) {
 		mem = bits;
 	}
 
-	particleBuffer_ = {dev, bufInfo, static_cast<unsigned int>(mem)};
-	particleBuffer_.ensureMemory();
+	vpp::Buffer buf = {dev, bufInfo, static_cast<unsigned int>(mem)};
+	buf.ensureMemory();
+	return buf;
+}
+
+void Renderer::writeCompDescriptors()
+{
+	writeCompDescriptor(compDescriptor_, particleBuffer_, particleBuffer_);
+	if(async_) {
+		// descriptors[i] simulates into buffer i
+		auto& bufs = async_->particleBuffer;
+		writeCompDescriptor(async_->descriptors[0], bufs, particleBuffer_);
+		writeCompDescriptor(async_->descriptors[1], particleBuffer_, bufs);
+		if(maxSubsteps_ > 1) {
+			writeCompDescriptor(async_->placeDescriptor, bufs, bufs);
+		}
+	}
+}
+
+void Renderer::writeCompDescriptor(const vpp::DescriptorSet& set,
+	const vpp::Buffer& in, const vpp::Buffer& out)
+{
+	// the whole buffers are bound, the particle count is passed
+	// with the frame data. Changing it does not touch the descriptors
+	auto range = vk::wholeSize;
+
+	vpp::DescriptorSetUpdate update(set);
+	update.storage({{in, 0, range}});
+	update.storage({{out, 0, range}}, 2);
+	update.storageDynamic({{attractorBuffer_, 0, attractorsSize}}, 3);
+	update.storage({{liveBuffer_, 0, vk::wholeSize}}, 7);
+	if(!pushConstants_) {
+		update.uniformDynamic({{compUbo_, 0, neededUniformSize}}, 1);
+	}
+
+	// without render stream, the shader never writes it but
+	// something has to be bound
+	if(renderStream_) {
+		update.storage({{vertexBuffer(out), 0, range}}, 4);
+	} else {
+		update.storage({{out, 0, range}}, 4);
+	}
+
+	// same for the spatial hash without interaction
+	if(interaction_) {
+		update.storage({{cellBuffer_, 0, range}}, 5);
+		update.storage({{cellEndBuffer_, 0, vk::wholeSize}}, 6);
+	} else {
+		update.storage({{out, 0, range}}, 5);
+		update.storage({{out, 0, range}}, 6);
+	}
+
+	// the alive list holds the draw command in any case
+	update.storage({{aliveBuffer(out), 0, range}}, 10);
+	if(lifecycle_) {
+		update.storage({{lifetimeBuffer_, 0, range}}, 8);
+		update.storage({{freeListBuffer_, 0, range}}, 9);
+	} else {
+		update.storage({{out, 0, range}}, 8);
+		update.storage({{out, 0, range}}, 9);
+	}
+}
+
+vpp::Buffer Renderer::createStreamBuffer(const vpp::Device& dev) const
+{
+	vk::BufferCreateInfo bufInfo;
+	bufInfo.usage = vk::BufferUsageBits::vertexBuffer
+		| vk::BufferUsageBits::storageBuffer;
+	bufInfo.size = sizeof(std::uint32_t) * particleCapacity_;
+
+	if(!queueFamilies_.empty()) {
+		bufInfo.sharingMode = vk::SharingMode::concurrent;
+		bufInfo.queueFamilyIndexCount = queueFamilies_.size();
+		bufInfo.pQueueFamilyIndices = queueFamilies_.data();
+	}
+
+	auto mem = dev.memoryTypeBits(vk::MemoryPropertyBits::deviceLocal);
+	vpp::Buffer buf = {dev, bufInfo, mem};
+	buf.ensureMemory();
+	return buf;
+}
+
+const vpp::Buffer& Renderer::vertexBuffer(const vpp::Buffer& particles) const
+{
+	if(!renderStream_) {
+		return particles;
+	}
+
+	if(async_ && &particles == &async_->particleBuffer) {
+		return async_->streamBuffer;
+	}
+
+	return streamBuffer_;
+}
+
+void Renderer::initSplat(const vpp::Device& dev)
+{
+	splat_ = settings_.splat;
+
+	// vertex data, density, draw data
+	splatDescriptorLayout_ = {dev, {
+		vpp::descriptorBinding(
+			vk::DescriptorType::storageBuffer,
+			vk::ShaderStageBits::compute, 0),
+		vpp::descriptorBinding(
+			vk::DescriptorType::storageBuffer,
+			vk::ShaderStageBits::compute, 1),
+		vpp::descriptorBinding(
+			vk::DescriptorType::uniformBuffer,
+			vk::ShaderStageBits::compute, 2)
+	}};
+	splatDescriptor_ = {splatDescriptorLayout_, descriptorPool_};
+
+	// size, first, count
+	vk::PushConstantRange splatRange;
+	splatRange.stageFlags = vk::ShaderStageBits::compute;
+	splatRange.size = sizeof(std::uint32_t) * 4;
+
+	vk::PipelineLayoutCreateInfo splatLayoutInfo;
+	splatLayoutInfo.setLayoutCount = 1;
+	splatLayoutInfo.pSetLayouts = &splatDescriptorLayout_.vkHandle();
+	splatLayoutInfo.pushConstantRangeCount = 1;
+	splatLayoutInfo.pPushConstantRanges = &splatRange;
+	splatPipelineLayout_ = {dev, splatLayoutInfo};
+
+	// reads the same data as the vertex shader
+	auto splatShader = nytl::Span<const std::uint32_t>(splat_comp_data);
+	if(renderStream_) {
+		splatShader = splat_stream_comp_data;
+	} else if(compact_) {
+		splatShader = splat_compact_comp_data;
+	}
+
+	splatPipeline_ = createComputePipeline(dev, *pipelineCache_,
+		splatPipelineLayout_, splatShader, workGroupSize_);
+
+	// density
+	resolveDescriptorLayout_ = {dev, {
+		vpp::descriptorBinding(
+			vk::DescriptorType::storageBuffer,
+			vk::ShaderStageBits::fragment, 0)
+	}};
+	resolveDescriptor_ = {resolveDescriptorLayout_, descriptorPool_};
+
+	// width
+	vk::PushConstantRange resolveRange;
+	resolveRange.stageFlags = vk::ShaderStageBits::fragment;
+	resolveRange.size = sizeof(std::uint32_t);
+
+	vk::PipelineLayoutCreateInfo resolveLayoutInfo;
+	resolveLayoutInfo.setLayoutCount = 1;
+	resolveLayoutInfo.pSetLayouts = &resolveDescriptorLayout_.vkHandle();
+	resolveLayoutInfo.pushConstantRangeCount = 1;
+	resolveLayoutInfo.pPushConstantRanges = &resolveRange;
+	resolvePipelineLayout_ = {dev, resolveLayoutInfo};
+
+	resolvePipeline_ = createResolvePipeline(dev, *pipelineCache_,
+		renderPass_, resolvePipelineLayout_, sampleCount_);
+}
+
+void Renderer::initDensity(const vpp::Device& dev, vk::Extent2D size)
+{
+	// two uints per pixel, see splat.comp.
+	// Also allocated when drawing points, so that splatting can be
+	// switched on at any time
+	vk::BufferCreateInfo bufInfo;
+	bufInfo.usage = vk::BufferUsageBits::storageBuffer
+		| vk::BufferUsageBits::transferDst;
+	bufInfo.size = 2 * sizeof(std::uint32_t) * size.width * size.height;
+
+	auto mem = dev.memoryTypeBits(vk::MemoryPropertyBits::deviceLocal);
+	densityBuffer_ = {dev, bufInfo, mem};
+	densityBuffer_.ensureMemory();
+	densitySize_ = size;
+
+	writeSplatDescriptors();
+}
+
+void Renderer::writeSplatDescriptors()
+{
+	// written as soon as the density buffer exists
+	if(!densityBuffer_.vkHandle()) {
+		return;
+	}
+
+	auto write = [&](const vpp::DescriptorSet& set, const vpp::Buffer& particles) {
+		vpp::DescriptorSetUpdate update(set);
+		update.storage({{vertexBuffer(particles), 0, vk::wholeSize}}, 0);
+		update.storage({{densityBuffer_, 0, vk::wholeSize}}, 1);
+		update.uniform({{drawDataBuffer_, 0, sizeof(shader::DrawData)}}, 2);
+	};
+
+	write(splatDescriptor_, particleBuffer_);
+	if(async_) {
+		write(async_->splatDescriptor, async_->particleBuffer);
+	}
+
+	vpp::DescriptorSetUpdate update(resolveDescriptor_);
+	update.storage({{densityBuffer_, 0, vk::wholeSize}}, 0);
+}
+
+void Renderer::recordSplat(vk::CommandBuffer cmdBuf,
+	const vpp::Buffer& particles)
+{
+	// the resolve of the previous frame must have read the density
+	// before it is cleared
+	vk::BufferMemoryBarrier barrier;
+	barrier.srcQueueFamilyIndex = vk::queueFamilyIgnored;
+	barrier.dstQueueFamilyIndex = vk::queueFamilyIgnored;
+	barrier.buffer = densityBuffer_;
+	barrier.size = vk::wholeSize;
+	barrier.srcAccessMask = {};
+	barrier.dstAccessMask = vk::AccessBits::transferWrite;
+	vk::cmdPipelineBarrier(cmdBuf, vk::PipelineStageBits::fragmentShader,
+		vk::PipelineStageBits::transfer, {}, {}, {barrier}, {});
+
+	vk::cmdFillBuffer(cmdBuf, densityBuffer_, 0, vk::wholeSize, 0u);
+
+	barrier.srcAccessMask = vk::AccessBits::transferWrite;
+	barrier.dstAccessMask = vk::AccessBits::shaderRead |
+		vk::AccessBits::shaderWrite;
+	vk::cmdPipelineBarrier(cmdBuf, vk::PipelineStageBits::transfer,
+		vk::PipelineStageBits::computeShader, {}, {}, {barrier}, {});
+
+	auto& set = (async_ && &particles == &async_->particleBuffer) ?
+		async_->splatDescriptor : splatDescriptor_;
+	vk::cmdBindPipeline(cmdBuf, vk::PipelineBindPoint::compute, splatPipeline_);
+	vk::cmdBindDescriptorSets(cmdBuf, vk::PipelineBindPoint::compute,
+		splatPipelineLayout_, 0, {set}, {});
+
+	std::uint32_t size[2] = {densitySize_.width, densitySize_.height};
+	vk::cmdPushConstants(cmdBuf, splatPipelineLayout_,
+		vk::ShaderStageBits::compute, 0, sizeof(size), size);
+	dispatchChunks(cmdBuf, splatPipelineLayout_, sizeof(size));
+
+	// read by the resolve pass
+	barrier.srcAccessMask = vk::AccessBits::shaderWrite;
+	barrier.dstAccessMask = vk::AccessBits::shaderRead;
+	vk::cmdPipelineBarrier(cmdBuf, vk::PipelineStageBits::computeShader,
+		vk::PipelineStageBits::fragmentShader, {}, {}, {barrier}, {});
+}
+
+void Renderer::splat(bool enable)
+{
+	if(enable == splat_) {
+		return;
+	}
+
+	dlg_info("{} the particles", enable ? "Splatting" : "Rasterizing");
+	splat_ = enable;
+
+	// the draw command buffers are re-recorded, none may be pending
+	if(headless()) {
+		vk::deviceWaitIdle(queue_->device());
+		recordOffscreen();
+	} else {
+		finishFrames();
+		invalidate();
+	}
+}
+
+void Renderer::zoom(float factor, nytl::Vec2f pos)
+{
+	// the domain position under pos stays the same
+	auto before = domainPosition(pos);
+	view_.zoom = std::clamp(view_.zoom * factor,
+		shader::minZoom, shader::maxZoom);
+	auto after = domainPosition(pos);
+	view_.center[0] += before[0] - after[0];
+	view_.center[1] += before[1] - after[1];
+	viewChanged();
+}
+
+void Renderer::pan(nytl::Vec2f delta)
+{
+	auto width = scInfo_.imageExtent.width;
+	auto height = scInfo_.imageExtent.height;
+	view_.center[0] -= 2 * delta[0] / (width * view_.zoom);
+	view_.center[1] -= 2 * delta[1] / (height * view_.zoom);
+	viewChanged();
+}
+
+void Renderer::resetView()
+{
+	view_.center = {0.f, 0.f};
+	view_.zoom = 1.f;
+	viewChanged();
+}
+
+nytl::Vec2f Renderer::domainPosition(nytl::Vec2f pos) const
+{
+	auto width = scInfo_.imageExtent.width;
+	auto height = scInfo_.imageExtent.height;
+	return {
+		(2 * (pos[0] / float(width)) - 1) / view_.zoom + view_.center[0],
+		(2 * (pos[1] / float(height)) - 1) / view_.zoom + view_.center[1]};
+}
+
+void Renderer::viewChanged()
+{
+	// zoomed out, about as many particles as at zoom 1 cover
+	// the same screen area
+	if(lod_) {
+		view_.drawFraction = std::min(view_.zoom * view_.zoom, 1.f);
+	}
+
+	// nothing is re-recorded. The draws read it from the draw data
+	// uploaded every frame, the simulation from the frame data
+}
+
+void Renderer::initSort(const vpp::Device& dev)
+{
+	sortInterval_ = settings_.sortInterval;
+	if(sortInterval_ && settings_.cpuSimulation) {
+		dlg_warn("The cpu simulation rewrites all particles, not sorting them");
+		sortInterval_ = 0u;
+	} else if(sortInterval_ && lifecycle_) {
+		dlg_warn("Sorting would separate the particles from their lifetimes");
+		sortInterval_ = 0u;
+	} else if(sortInterval_ && cull_) {
+		dlg_warn("Sorting would invalidate the culled index list");
+		sortInterval_ = 0u;
+	}
+
+	// the level of detail draws the first particles, which are a
+	// screen region once sorted
+	if(sortInterval_ && lod_) {
+		dlg_warn("Not using the level of detail with sorting");
+		lod_ = false;
+		view_.drawFraction = 1.f;
+	}
+
+	if(!sortInterval_) {
+		return;
+	}
+
+	dlg_info("Sorting the particles every {} frames", sortInterval_);
+
+	// particles, sorted particles, bins
+	sortDescriptorLayout_ = {dev, {
+		vpp::descriptorBinding(
+			vk::DescriptorType::storageBuffer,
+			vk::ShaderStageBits::compute, 0),
+		vpp::descriptorBinding(
+			vk::DescriptorType::storageBuffer,
+			vk::ShaderStageBits::compute, 1),
+		vpp::descriptorBinding(
+			vk::DescriptorType::storageBuffer,
+			vk::ShaderStageBits::compute, 2)
+	}};
+	sortDescriptor_ = {sortDescriptorLayout_, descriptorPool_};
+
+	// first, count
+	vk::PushConstantRange range;
+	range.stageFlags = vk::ShaderStageBits::compute;
+	range.size = sizeof(std::uint32_t) * 2;
+
+	vk::PipelineLayoutCreateInfo layoutInfo;
+	layoutInfo.setLayoutCount = 1;
+	layoutInfo.pSetLayouts = &sortDescriptorLayout_.vkHandle();
+	layoutInfo.pushConstantRangeCount = 1;
+	layoutInfo.pPushConstantRanges = &range;
+	sortPipelineLayout_ = {dev, layoutInfo};
+
+	auto countShader = nytl::Span<const std::uint32_t>(sort_count_comp_data);
+	auto scatterShader = nytl::Span<const std::uint32_t>(sort_scatter_comp_data);
+	if(compact_) {
+		countShader = sort_count_compact_comp_data;
+		scatterShader = sort_scatter_compact_comp_data;
+	}
+
+	sortCountPipeline_ = createComputePipeline(dev, *pipelineCache_,
+		sortPipelineLayout_, countShader, workGroupSize_);
+	sortScanPipeline_ = createComputePipeline(dev, *pipelineCache_,
+		sortPipelineLayout_, sort_scan_comp_data, workGroupSize_);
+	sortScatterPipeline_ = createComputePipeline(dev, *pipelineCache_,
+		sortPipelineLayout_, scatterShader, workGroupSize_);
+
+	sortBuffer_ = createParticleBuffer(dev);
+
+	vk::BufferCreateInfo bufInfo;
+	bufInfo.usage = vk::BufferUsageBits::storageBuffer
+		| vk::BufferUsageBits::transferDst;
+	bufInfo.size = shader::sortBins * sizeof(std::uint32_t);
+
+	auto mem = dev.memoryTypeBits(vk::MemoryPropertyBits::deviceLocal);
+	binBuffer_ = {dev, bufInfo, mem};
+	binBuffer_.ensureMemory();
+
+	writeSortDescriptors();
+}
+
+void Renderer::writeSortDescriptors()
+{
+	if(!sortInterval_) {
+		return;
+	}
+
+	auto write = [&](const vpp::DescriptorSet& set, const vpp::Buffer& particles) {
+		vpp::DescriptorSetUpdate update(set);
+		update.storage({{particles, 0, vk::wholeSize}}, 0);
+		update.storage({{sortBuffer_, 0, vk::wholeSize}}, 1);
+		update.storage({{binBuffer_, 0, vk::wholeSize}}, 2);
+	};
+
+	write(sortDescriptor_, particleBuffer_);
+	if(async_) {
+		write(async_->sortDescriptor, async_->particleBuffer);
+	}
+}
+
+void Renderer::recordSort(vk::CommandBuffer cmdBuf, unsigned int slice)
+{
+	writeTimestamp(cmdBuf, slice, sortBegin, vk::PipelineStageBits::topOfPipe);
+
+	// sorts the buffer the simulation just wrote, see recordCompute
+	auto target = async_ ? (slice + 1) % 2 : 0u;
+	auto& particles = target ? async_->particleBuffer : particleBuffer_;
+	auto& set = target ? async_->sortDescriptor : sortDescriptor_;
+
+	// waits for the simulation and for previous sorts, which used
+	// the same bins and sort buffer
+	vk::MemoryBarrier barrier;
+	barrier.srcAccessMask = vk::AccessBits::shaderWrite |
+		vk::AccessBits::transferWrite;
+	barrier.dstAccessMask = vk::AccessBits::shaderRead |
+		vk::AccessBits::shaderWrite | vk::AccessBits::transferWrite;
+	vk::cmdPipelineBarrier(cmdBuf,
+		vk::PipelineStageBits::computeShader | vk::PipelineStageBits::transfer,
+		vk::PipelineStageBits::computeShader | vk::PipelineStageBits::transfer,
+		{}, {barrier}, {}, {});
+
+	vk::cmdFillBuffer(cmdBuf, binBuffer_, 0, vk::wholeSize, 0u);
+
+	barrier.srcAccessMask = vk::AccessBits::transferWrite;
+	barrier.dstAccessMask = vk::AccessBits::shaderRead |
+		vk::AccessBits::shaderWrite;
+	vk::cmdPipelineBarrier(cmdBuf, vk::PipelineStageBits::transfer,
+		vk::PipelineStageBits::computeShader, {}, {barrier}, {}, {});
+
+	vk::cmdBindDescriptorSets(cmdBuf, vk::PipelineBindPoint::compute,
+		sortPipelineLayout_, 0, {set}, {});
+
+	// every pass reads the bins written by the previous one
+	barrier.srcAccessMask = vk::AccessBits::shaderWrite;
+	vk::cmdBindPipeline(cmdBuf, vk::PipelineBindPoint::compute,
+		sortCountPipeline_);
+	dispatchChunks(cmdBuf, sortPipelineLayout_, 0u);
+	vk::cmdPipelineBarrier(cmdBuf, vk::PipelineStageBits::computeShader,
+		vk::PipelineStageBits::computeShader, {}, {barrier}, {}, {});
+
+	vk::cmdBindPipeline(cmdBuf, vk::PipelineBindPoint::compute,
+		sortScanPipeline_);
+	vk::cmdDispatch(cmdBuf, 1, 1, 1);
+	vk::cmdPipelineBarrier(cmdBuf, vk::PipelineStageBits::computeShader,
+		vk::PipelineStageBits::computeShader, {}, {barrier}, {}, {});
+
+	vk::cmdBindPipeline(cmdBuf, vk::PipelineBindPoint::compute,
+		sortScatterPipeline_);
+	dispatchChunks(cmdBuf, sortPipelineLayout_, 0u);
+
+	// copy the sorted particles back
+	barrier.srcAccessMask = vk::AccessBits::shaderWrite;
+	barrier.dstAccessMask = vk::AccessBits::transferRead;
+	vk::cmdPipelineBarrier(cmdBuf, vk::PipelineStageBits::computeShader,
+		vk::PipelineStageBits::transfer, {}, {barrier}, {}, {});
+
+	vk::cmdCopyBuffer(cmdBuf, sortBuffer_, particles,
+		{{0, 0, particleCount_ * particleSize()}});
+
+	// the following simulation step or draw barrier (particleBarrier)
+	// synchronize with the compute stage, this chains the copy to them
+	barrier.srcAccessMask = vk::AccessBits::transferWrite;
+	barrier.dstAccessMask = vk::AccessBits::shaderRead |
+		vk::AccessBits::shaderWrite;
+	vk::cmdPipelineBarrier(cmdBuf, vk::PipelineStageBits::transfer,
+		vk::PipelineStageBits::computeShader, {}, {barrier}, {}, {});
+
+	writeTimestamp(cmdBuf, slice, sortEnd, vk::PipelineStageBits::bottomOfPipe);
+}
+
+void Renderer::initGrid(const vpp::Device& dev)
+{
+	if(!interaction_) {
+		return;
+	}
+
+	// particles, cell positions, bins
+	gridDescriptorLayout_ = {dev, {
+		vpp::descriptorBinding(
+			vk::DescriptorType::storageBuffer,
+			vk::ShaderStageBits::compute, 0),
+		vpp::descriptorBinding(
+			vk::DescriptorType::storageBuffer,
+			vk::ShaderStageBits::compute, 1),
+		vpp::descriptorBinding(
+			vk::DescriptorType::storageBuffer,
+			vk::ShaderStageBits::compute, 2)
+	}};
+	gridDescriptor_ = {gridDescriptorLayout_, descriptorPool_};
+
+	// first, count, cell size
+	vk::PushConstantRange range;
+	range.stageFlags = vk::ShaderStageBits::compute;
+	range.size = sizeof(std::uint32_t) * 3;
+
+	vk::PipelineLayoutCreateInfo layoutInfo;
+	layoutInfo.setLayoutCount = 1;
+	layoutInfo.pSetLayouts = &gridDescriptorLayout_.vkHandle();
+	layoutInfo.pushConstantRangeCount = 1;
+	layoutInfo.pPushConstantRanges = &range;
+	gridPipelineLayout_ = {dev, layoutInfo};
+
+	auto countShader = nytl::Span<const std::uint32_t>(grid_count_comp_data);
+	auto scatterShader = nytl::Span<const std::uint32_t>(grid_scatter_comp_data);
+	if(compact_) {
+		countShader = grid_count_compact_comp_data;
+		scatterShader = grid_scatter_compact_comp_data;
+	}
+
+	// the bins are scanned like the ones of the sort
+	gridCountPipeline_ = createComputePipeline(dev, *pipelineCache_,
+		gridPipelineLayout_, countShader, workGroupSize_);
+	gridScanPipeline_ = createComputePipeline(dev, *pipelineCache_,
+		gridPipelineLayout_, sort_scan_comp_data, workGroupSize_);
+	gridScatterPipeline_ = createComputePipeline(dev, *pipelineCache_,
+		gridPipelineLayout_, scatterShader, workGroupSize_);
+
+	writeGridDescriptors();
+}
+
+void Renderer::writeGridDescriptors()
+{
+	if(!interaction_) {
+		return;
+	}
+
+	auto write = [&](const vpp::DescriptorSet& set, const vpp::Buffer& particles) {
+		vpp::DescriptorSetUpdate update(set);
+		update.storage({{particles, 0, vk::wholeSize}}, 0);
+		update.storage({{cellBuffer_, 0, vk::wholeSize}}, 1);
+		update.storage({{cellEndBuffer_, 0, vk::wholeSize}}, 2);
+	};
+
+	write(gridDescriptor_, particleBuffer_);
+	if(async_) {
+		write(async_->gridDescriptor, async_->particleBuffer);
+	}
+}
+
+void Renderer::recordGrid(vk::CommandBuffer cmdBuf, unsigned int source)
+{
+	// hashes the input particles of the simulation step, see recordCompute
+	auto& set = source ? async_->gridDescriptor : gridDescriptor_;
+
+	// waits for the previous simulation steps, which wrote the
+	// particles and read the spatial hash
+	vk::MemoryBarrier barrier;
+	barrier.srcAccessMask = vk::AccessBits::shaderWrite |
+		vk::AccessBits::transferWrite;
+	barrier.dstAccessMask = vk::AccessBits::shaderRead |
+		vk::AccessBits::shaderWrite | vk::AccessBits::transferWrite;
+	vk::cmdPipelineBarrier(cmdBuf,
+		vk::PipelineStageBits::computeShader | vk::PipelineStageBits::transfer,
+		vk::PipelineStageBits::computeShader | vk::PipelineStageBits::transfer,
+		{}, {barrier}, {}, {});
+
+	vk::cmdFillBuffer(cmdBuf, cellEndBuffer_, 0, vk::wholeSize, 0u);
+
+	barrier.srcAccessMask = vk::AccessBits::transferWrite;
+	barrier.dstAccessMask = vk::AccessBits::shaderRead |
+		vk::AccessBits::shaderWrite;
+	vk::cmdPipelineBarrier(cmdBuf, vk::PipelineStageBits::transfer,
+		vk::PipelineStageBits::computeShader, {}, {barrier}, {}, {});
+
+	vk::cmdBindDescriptorSets(cmdBuf, vk::PipelineBindPoint::compute,
+		gridPipelineLayout_, 0, {set}, {});
+	auto cellSize = settings_.interactionRadius;
+	vk::cmdPushConstants(cmdBuf, gridPipelineLayout_,
+		vk::ShaderStageBits::compute, 2 * sizeof(std::uint32_t),
+		sizeof(cellSize), &cellSize);
+
+	// every pass reads the bins written by the previous one
+	barrier.srcAccessMask = vk::AccessBits::shaderWrite;
+	vk::cmdBindPipeline(cmdBuf, vk::PipelineBindPoint::compute,
+		gridCountPipeline_);
+	dispatchChunks(cmdBuf, gridPipelineLayout_, 0u);
+	vk::cmdPipelineBarrier(cmdBuf, vk::PipelineStageBits::computeShader,
+		vk::PipelineStageBits::computeShader, {}, {barrier}, {}, {});
+
+	vk::cmdBindPipeline(cmdBuf, vk::PipelineBindPoint::compute,
+		gridScanPipeline_);
+	vk::cmdDispatch(cmdBuf, 1, 1, 1);
+	vk::cmdPipelineBarrier(cmdBuf, vk::PipelineStageBits::computeShader,
+		vk::PipelineStageBits::computeShader, {}, {barrier}, {}, {});
+
+	vk::cmdBindPipeline(cmdBuf, vk::PipelineBindPoint::compute,
+		gridScatterPipeline_);
+	dispatchChunks(cmdBuf, gridPipelineLayout_, 0u);
+
+	// read by the simulation
+	barrier.dstAccessMask = vk::AccessBits::shaderRead;
+	vk::cmdPipelineBarrier(cmdBuf, vk::PipelineStageBits::computeShader,
+		vk::PipelineStageBits::computeShader, {}, {barrier}, {}, {});
+}
+
+void Renderer::initEmit(const vpp::Device& dev)
+{
+	if(!lifecycle_) {
+		return;
+	}
+
+	// particles, render stream, lifetimes, free list, alive list, emitters
+	emitDescriptorLayout_ = {dev, {
+		vpp::descriptorBinding(
+			vk::DescriptorType::storageBuffer,
+			vk::ShaderStageBits::compute, 0),
+		vpp::descriptorBinding(
+			vk::DescriptorType::storageBuffer,
+			vk::ShaderStageBits::compute, 1),
+		vpp::descriptorBinding(
+			vk::DescriptorType::storageBuffer,
+			vk::ShaderStageBits::compute, 2),
+		vpp::descriptorBinding(
+			vk::DescriptorType::storageBuffer,
+			vk::ShaderStageBits::compute, 3),
+		vpp::descriptorBinding(
+			vk::DescriptorType::storageBuffer,
+			vk::ShaderStageBits::compute, 4),
+		vpp::descriptorBinding(
+			vk::DescriptorType::storageBufferDynamic,
+			vk::ShaderStageBits::compute, 5)
+	}};
+	emitDescriptor_ = {emitDescriptorLayout_, descriptorPool_};
+
+	vk::PipelineLayoutCreateInfo layoutInfo;
+	layoutInfo.setLayoutCount = 1;
+	layoutInfo.pSetLayouts = &emitDescriptorLayout_.vkHandle();
+	emitPipelineLayout_ = {dev, layoutInfo};
+
+	auto shader = nytl::Span<const std::uint32_t>(emit_comp_data);
+	if(compact_) {
+		shader = emit_compact_comp_data;
+	}
+
+	emitPipeline_ = createComputePipeline(dev, *pipelineCache_,
+		emitPipelineLayout_, shader, workGroupSize_, renderStream_);
+	writeEmitDescriptors();
+}
+
+void Renderer::writeEmitDescriptors()
+{
+	if(!lifecycle_) {
+		return;
+	}
+
+	auto range = vk::wholeSize;
+	auto write = [&](const vpp::DescriptorSet& set, const vpp::Buffer& particles) {
+		vpp::DescriptorSetUpdate update(set);
+		update.storage({{particles, 0, range}}, 0);
+		update.storage({{vertexBuffer(particles), 0, range}}, 1);
+		update.storage({{lifetimeBuffer_, 0, range}}, 2);
+		update.storage({{freeListBuffer_, 0, vk::wholeSize}}, 3);
+		update.storage({{aliveBuffer(particles), 0, vk::wholeSize}}, 4);
+		update.storageDynamic({{emitterBuffer_, 0, emittersSize}}, 5);
+	};
+
+	write(emitDescriptor_, particleBuffer_);
+	if(async_) {
+		write(async_->emitDescriptor, async_->particleBuffer);
+	}
+}
+
+void Renderer::recordEmit(vk::CommandBuffer cmdBuf, unsigned int slice)
+{
+	// spawns into the buffer the simulation just wrote, see recordCompute
+	auto target = async_ ? (slice + 1) % 2 : 0u;
+	auto& set = target ? async_->emitDescriptor : emitDescriptor_;
+
+	// the simulation pushed the dead particles onto the free list
+	// and appended the alive ones
+	vk::MemoryBarrier barrier;
+	barrier.srcAccessMask = vk::AccessBits::shaderWrite;
+	barrier.dstAccessMask = vk::AccessBits::shaderRead |
+		vk::AccessBits::shaderWrite;
+	vk::cmdPipelineBarrier(cmdBuf, vk::PipelineStageBits::computeShader,
+		vk::PipelineStageBits::computeShader, {}, {barrier}, {}, {});
+
+	std::uint32_t emitterOffset = slice * emitterSliceSize_;
+	vk::cmdBindPipeline(cmdBuf, vk::PipelineBindPoint::compute, emitPipeline_);
+	vk::cmdBindDescriptorSets(cmdBuf, vk::PipelineBindPoint::compute,
+		emitPipelineLayout_, 0, {set}, {emitterOffset});
+
+	// the group count was written into the header in update
+	vk::cmdDispatchIndirect(cmdBuf, emitterBuffer_, emitterOffset);
+}
+
+void Renderer::writeEmitters(unsigned int slice, double delta)
+{
+	if(emitters_.size() > shader::maxEmitters) {
+		dlg_warn("Only {} emitters are supported", shader::maxEmitters);
+		emitters_.resize(shader::maxEmitters);
+	}
+
+	// fractional particles are spawned in later frames. More than
+	// the whole pool can't be spawned at once
+	std::uint32_t count = emitters_.size();
+	spawnDebt_ += delta * settings_.emitRate * count;
+	auto spawn = static_cast<std::uint32_t>(spawnDebt_);
+	spawnDebt_ -= spawn;
+	spawn = std::min(spawn, particleCount_);
+
+	shader::EmitHeader header {};
+	header.groups[0] = (spawn + workGroupSize_ - 1) / workGroupSize_;
+	header.groups[1] = 1u;
+	header.groups[2] = 1u;
+	header.emitterCount = count;
+	header.spawnCount = spawn;
+	header.frame = frame_;
+
+	auto emitterOffset = slice * emitterSliceSize_;
+	auto ptr = emitterMap_.ptr() + emitterOffset;
+	write(ptr, header);
+
+	// split evenly, the first emitters spawn the remainder
+	auto first = 0u;
+	for(auto i = 0u; i < count; ++i) {
+		shader::Emitter emitter;
+		emitter.pos = emitters_[i];
+		emitter.speed = settings_.emitSpeed;
+		emitter.lifetime = settings_.lifetime;
+		emitter.first = first;
+		emitter.count = spawn / count + (i < spawn % count);
+		first += emitter.count;
+		write(ptr, emitter);
+	}
+
+	if(!emitterMap_.coherent()) {
+		flushMapped(emitterMap_, emitterOffset,
+			sizeof(header) + count * sizeof(shader::Emitter));
+	}
+}
+
+void Renderer::initAliveLists()
+{
+	// the simulation writes the draw command. The cpu simulation does
+	// not, so it gets the full count up front. With lifecycle, all
+	// particles start dead and every slot is free. The staging buffer
+	// holds the initial draw command followed by the free list
+	auto& dev = queue_->device();
+	auto drawSize = sizeof(shader::DrawCommand);
+	auto freeSize = lifecycle_ ?
+		(particleCount_ + 1) * sizeof(std::uint32_t) : 0u;
+
+	vk::BufferCreateInfo bufInfo;
+	bufInfo.usage = vk::BufferUsageBits::transferSrc;
+	bufInfo.size = drawSize + freeSize;
+	auto mem = dev.memoryTypeBits(vk::MemoryPropertyBits::hostVisible);
+	vpp::Buffer staging {dev, bufInfo, mem};
+	staging.ensureMemory();
+
+	{
+		auto map = staging.memoryMap();
+		auto ptr = map.ptr();
+
+		shader::DrawCommand draw {};
+		draw.instanceCount = 1u;
+		if(settings_.cpuSimulation) {
+			draw.indexCount = particleCount_;
+		}
+
+		write(ptr, draw);
+
+		if(lifecycle_) {
+			auto freeList = reinterpret_cast<std::uint32_t*>(ptr);
+			freeList[0] = particleCount_;
+			std::iota(freeList + 1, freeList + 1 + particleCount_, 0u);
+		}
+
+		if(!map.coherent()) {
+			map.flush();
+		}
+	}
+
+	submitWait(*queue_, [&](vk::CommandBuffer cmdBuf) {
+		if(lifecycle_) {
+			vk::cmdFillBuffer(cmdBuf, lifetimeBuffer_, 0, vk::wholeSize, 0u);
+			vk::cmdCopyBuffer(cmdBuf, staging, freeListBuffer_,
+				{{drawSize, 0, freeSize}});
+		}
+
+		vk::cmdCopyBuffer(cmdBuf, staging, aliveBuffer_, {{0, 0, drawSize}});
+		if(async_) {
+			vk::cmdCopyBuffer(cmdBuf, staging, async_->aliveBuffer,
+				{{0, 0, drawSize}});
+		}
+	});
+}
+
+const vpp::Buffer& Renderer::aliveBuffer(const vpp::Buffer& particles) const
+{
+	if(async_ && &particles == &async_->particleBuffer) {
+		return async_->aliveBuffer;
+	}
+
+	return aliveBuffer_;
+}
+
+vpp::Buffer Renderer::createAliveBuffer(const vpp::Device& dev) const
+{
+	// draw command, followed by the indices of the alive particles
+	// if they are drawn indexed
+	auto size = sizeof(shader::DrawCommand);
+	if(indexedDraw()) {
+		size += particleCapacity_ * sizeof(std::uint32_t);
+	}
+
+	return createStorageBuffer(dev, size,
+		vk::BufferUsageBits::indexBuffer |
+		vk::BufferUsageBits::indirectBuffer |
+		vk::BufferUsageBits::transferDst, queueFamilies_);
+}
+
+void Renderer::dispatchChunks(vk::CommandBuffer cmdBuf,
+	vk::PipelineLayout layout, std::uint32_t pushOffset)
+{
+	// a single dispatch is limited in the number of work groups
+	auto& limits = queue_->device().properties().limits;
+	auto maxGroups = std::min(limits.maxComputeWorkGroupCount[0],
+		UINT32_MAX / workGroupSize_);
+	auto chunk = maxGroups * workGroupSize_;
+	for(auto off = 0u; off < particleCount_; off += chunk) {
+		std::uint32_t range[2] = {off, std::min(chunk, particleCount_ - off)};
+		vk::cmdPushConstants(cmdBuf, layout, vk::ShaderStageBits::compute,
+			pushOffset, sizeof(range), range);
+
+		auto groups = (range[1] + workGroupSize_ - 1) / workGroupSize_;
+		vk::cmdDispatch(cmdBuf, groups, 1, 1);
+	}
+}
+
+bool Renderer::checkAsync(const vpp::Queue& gfx, const vpp::Queue* compute)
+{
+	if(settings_.cpuSimulation) {
+		dlg_warn("Simulating on the cpu, not using async compute");
+		return false;
+	}
+
+	if(!compute) {
+		dlg_warn("No dedicated compute queue, not using async compute");
+		return false;
+	}
+
+	if(compute->family() == gfx.family()) {
+		dlg_warn("Compute queue not from separate family, not using async compute");
+		return false;
+	}
+
+	dlg_info("Using async compute on queue family {}", compute->family());
+	return true;
+}
+
+void Renderer::initAsync(const vpp::Device& dev, const vpp::Queue& gfx,
+	const vpp::Queue& compute)
+{
+	async_ = std::make_unique<AsyncCompute>();
+	async_->queue = &compute;
+
+	// the simulation timestamps are written on the compute queue
+	auto validBits = compute.properties().timestampValidBits;
+	if(validBits == 0) {
+		if(queryPool_.vkHandle()) {
+			dlg_warn("Compute queue does not support timestamps, "
+				"no gpu compute timings");
+		}
+
+		computeTimestampMask_ = 0u;
+	} else if(validBits < 64) {
+		computeTimestampMask_ = (std::uint64_t(1) << validBits) - 1;
+	}
+	async_->particleBuffer = createParticleBuffer(dev);
+	if(renderStream_) {
+		async_->streamBuffer = createStreamBuffer(dev);
+	}
+	async_->computeDone = {dev};
+
+	for(auto i = 0u; i < 2u; ++i) {
+		async_->descriptors[i] = {compDescriptorLayout_, descriptorPool_};
+		async_->bufferFree[i] = {dev};
+	}
+
+	// the substeps after the first one simulate in place
+	if(maxSubsteps_ > 1) {
+		async_->placeDescriptor = {compDescriptorLayout_, descriptorPool_};
+	}
+
+	async_->splatDescriptor = {splatDescriptorLayout_, descriptorPool_};
+	if(sortInterval_) {
+		async_->sortDescriptor = {sortDescriptorLayout_, descriptorPool_};
+	}
+
+	if(interaction_) {
+		async_->gridDescriptor = {gridDescriptorLayout_, descriptorPool_};
+	}
+
+	if(lifecycle_) {
+		async_->emitDescriptor = {emitDescriptorLayout_, descriptorPool_};
+	}
+
+	async_->aliveBuffer = createAliveBuffer(dev);
+	initAliveLists();
+
+	writeCompDescriptors();
+	writeSplatDescriptors();
+	writeSortDescriptors();
+	writeGridDescriptors();
+	writeEmitDescriptors();
+}
+
+nytl::Span<const std::uint32_t> Renderer::compShader() const
+{
+	if(compact_ && pushConstants_) {
+		return particles_compact_push_comp_data;
+	} else if(compact_) {
+		return particles_compact_comp_data;
+	} else if(pushConstants_) {
+		return particles_push_comp_data;
+	}
+
+	return particles_comp_data;
+}
+
+void Renderer::initCompute(const vpp::Device& dev)
+{
+	auto& queue = async_ ? *async_->queue : *queue_;
+	computeFrames_.resize(uniformSlices);
+	for(auto& frame : computeFrames_) {
+		for(auto i = 0u; i < maxSubsteps_; ++i) {
+			frame.commandBuffers.push_back(dev.commandAllocator().get(
+				queue.family(), vk::CommandPoolCreateBits::resetCommandBuffer));
+			if(sortInterval_) {
+				frame.sortCommandBuffers.push_back(dev.commandAllocator().get(
+					queue.family(), vk::CommandPoolCreateBits::resetCommandBuffer));
+			}
+		}
+
+		// the fences are waited for before the first submission
+		vk::FenceCreateInfo fenceInfo;
+		fenceInfo.flags = vk::FenceCreateBits::signaled;
+		frame.fence = {dev, fenceInfo};
+	}
+
+	recordCompute();
+}
+
+void Renderer::recordCompute()
+{
+	for(auto i = 0u; i < computeFrames_.size(); ++i) {
+		for(auto steps = 1u; steps <= maxSubsteps_; ++steps) {
+			recordComputeFrame(i, steps);
+		}
+	}
+}
+
+void Renderer::recordComputeFrame(unsigned int slice, unsigned int steps)
+{
+	auto& frame = computeFrames_[slice];
+	auto& cmdBuf = frame.commandBuffers[steps - 1];
+	vk::beginCommandBuffer(cmdBuf, {});
+	recordCompute(cmdBuf, slice, steps);
+	vk::endCommandBuffer(cmdBuf);
+
+	if(sortInterval_) {
+		auto& sortCmdBuf = frame.sortCommandBuffers[steps - 1];
+		vk::beginCommandBuffer(sortCmdBuf, {});
+		recordCompute(sortCmdBuf, slice, steps);
+		recordSort(sortCmdBuf, slice);
+		vk::endCommandBuffer(sortCmdBuf);
+	}
+}
+
+unsigned int Renderer::submitCompute()
+{
+	auto slice = frame_ % uniformSlices;
+	auto& frame = computeFrames_[slice];
+	auto& queue = async_ ? *async_->queue : *queue_;
+	auto& dev = queue.device();
+
+	// already waited for in update
+	vk::waitForFences(dev, {frame.fence}, true, UINT64_MAX);
+	vk::resetFences(dev, {frame.fence});
+
+	// every sortInterval_ frames, the particles are sorted afterwards.
+	// Frames without simulation steps don't submit anything
+	dlg_assert(substeps_ > 0 && substeps_ <= maxSubsteps_);
+	auto sort = sortInterval_ && frame_ % sortInterval_ == sortInterval_ - 1;
+	auto& cmdBufs = sort ? frame.sortCommandBuffers : frame.commandBuffers;
+	auto& cmdBuf = cmdBufs[substeps_ - 1];
+	frame.substeps = substeps_;
+
+	vk::SubmitInfo info;
+	info.commandBufferCount = 1;
+	info.pCommandBuffers = &cmdBuf.vkHandle();
+	timestampsSubmitted(slice, computeBegin);
+	if(sort) {
+		timestampsSubmitted(slice, sortBegin);
+	}
+
+	++frame_;
+
+	if(!async_) {
+		vk::queueSubmit(queue.vkHandle(), {info}, frame.fence);
+		return 0u;
+	}
+
+	// overwriting the destination buffer requires that rendering
+	// it (two frames ago) has finished
+	auto dst = 1 - async_->current;
+	vk::PipelineStageFlags waitStage = vk::PipelineStageBits::computeShader;
+	info.signalSemaphoreCount = 1;
+	info.pSignalSemaphores = &async_->computeDone.vkHandle();
+	if(async_->bufferUsed[dst]) {
+		info.waitSemaphoreCount = 1;
+		info.pWaitSemaphores = &async_->bufferFree[dst].vkHandle();
+		info.pWaitDstStageMask = &waitStage;
+	}
+
+	vk::queueSubmit(queue.vkHandle(), {info}, frame.fence);
+
+	async_->bufferUsed[dst] = true;
+	async_->current = dst;
+	return dst;
+}
+
+const vpp::Buffer& Renderer::drawBuffer() const
+{
+	if(async_ && async_->current == 1) {
+		return async_->particleBuffer;
+	}
+
+	return particleBuffer_;
+}
+
+void Renderer::renderFrame()
+{
+	// the fence of the slot is submitted again below. A requested
+	// size or sample count is switched to between frames
+	waitFrame();
+	applyResize();
+	applySamples();
+
+	// the simulation is submitted separately since the command buffer
+	// depends on the uniform buffer slice of the frame. The
+	// render buffers wait for it with a barrier.
+	// The cpu simulation writes the particles of the next frame
+	// on the host, this one must have finished until then
+	// Without a simulation step in this frame, the latest state is
+	// drawn again
+	// The view and extrapolation are uploaded for the draws before,
+	// the slot was waited for so its command buffer is free
+	auto& slot = frameSlots_[frameSlot_];
+	if(swapchain_.vkHandle()) {
+		recordDrawData(slot.drawData);
+		vk::SubmitInfo info;
+		info.commandBufferCount = 1;
+		info.pCommandBuffers = &slot.drawData.vkHandle();
+		vk::queueSubmit(*queue_, {info}, {});
+	}
+
+	auto res = vk::Result::success;
+	if(!swapchain_.vkHandle()) {
+		simulateFrame();
+	} else if(cpuSim_) {
+		res = renderBlock();
+	} else if(!async_) {
+		if(substeps_ > 0u) {
+			submitCompute();
+		}
+
+		res = render();
+	} else {
+		// the rendering waits for the simulation (or, without a
+		// simulation step, the previous draw of the buffer) and signals
+		// that the buffer can be used as simulation target again.
+		// The semaphores are waited and signaled in batches of their own
+		// around the rendering, a wait also orders all later submissions.
+		// They stay balanced when vpp does not submit the rendering
+		// since the image could not be acquired
+		auto buffer = async_->current;
+		vk::Semaphore wait {};
+		if(substeps_ > 0u) {
+			buffer = submitCompute();
+			wait = async_->computeDone;
+		} else if(async_->bufferUsed[buffer]) {
+			wait = async_->bufferFree[buffer];
+		}
+
+		vk::PipelineStageFlags waitStage = vk::PipelineStageBits::drawIndirect |
+			vk::PipelineStageBits::vertexInput |
+			vk::PipelineStageBits::computeShader;
+		if(wait) {
+			vk::SubmitInfo info;
+			info.waitSemaphoreCount = 1;
+			info.pWaitSemaphores = &wait;
+			info.pWaitDstStageMask = &waitStage;
+			vk::queueSubmit(*queue_, {info}, {});
+		}
+
+		res = render();
+
+		vk::SubmitInfo info;
+		info.signalSemaphoreCount = 1;
+		info.pSignalSemaphores = &async_->bufferFree[buffer].vkHandle();
+		vk::queueSubmit(*queue_, {info}, {});
+		async_->bufferUsed[buffer] = true;
+	}
+
+	// the swapchain is recreated at the start of the next frame
+	if(res == vk::Result::errorOutOfDateKHR ||
+			res == vk::Result::suboptimalKHR) {
+		pendingSize_ = scInfo_.imageExtent;
+		resizePending_ = true;
+		swapchainOutdated_ = true;
+	} else if(res != vk::Result::success) {
+		dlg_warn("Rendering the frame failed: {}", static_cast<int>(res));
+	}
+
+	// an empty submission, its fence is signaled when all previously
+	// submitted work on the queue has finished. With async compute
+	// the rendering waited for the simulation
+	vk::queueSubmit(*queue_, {}, slot.fence);
+	slot.pending = true;
+	slot.input = input_;
+	frameSlot_ = (frameSlot_ + 1) % frameSlots_.size();
+
+	auto queued = std::chrono::duration<double>(Clock::now() - input_);
+	latency_.queued.add(1000 * queued.count());
+}
+
+void Renderer::waitFrame()
+{
+	// the frames that already finished are noticed as early
+	// as possible for the latency statistics
+	auto& dev = queue_->device();
+	for(auto& slot : frameSlots_) {
+		if(slot.pending && vk::getFenceStatus(dev, slot.fence) ==
+				vk::Result::success) {
+			finishFrame(slot);
+		}
+	}
+
+	if(frameSlots_.empty() || !frameSlots_[frameSlot_].pending) {
+		return;
+	}
+
+	auto& slot = frameSlots_[frameSlot_];
+	vk::waitForFences(dev, {slot.fence}, true, UINT64_MAX);
+	finishFrame(slot);
+}
+
+void Renderer::simulateFrame()
+{
+	// the cpu simulation already stepped in update
+	if(cpuSim_ || substeps_ == 0u) {
+		return;
+	}
+
+	auto dst = submitCompute();
+	if(!async_) {
+		return;
+	}
+
+	// takes the place of the rendering: consumes the semaphore of
+	// the simulation and frees the buffer for a later one
+	vk::PipelineStageFlags waitStage = vk::PipelineStageBits::allCommands;
+	vk::SubmitInfo info;
+	info.waitSemaphoreCount = 1;
+	info.pWaitSemaphores = &async_->computeDone.vkHandle();
+	info.pWaitDstStageMask = &waitStage;
+	info.signalSemaphoreCount = 1;
+	info.pSignalSemaphores = &async_->bufferFree[dst].vkHandle();
+	vk::queueSubmit(queue_->vkHandle(), {info}, {});
+}
+
+void Renderer::finishFrames()
+{
+	auto& dev = queue_->device();
+	for(auto& slot : frameSlots_) {
+		if(slot.pending) {
+			vk::waitForFences(dev, {slot.fence}, true, UINT64_MAX);
+			finishFrame(slot);
+		}
+	}
+}
+
+void Renderer::finishFrame(FrameSlot& slot)
+{
+	vk::resetFences(queue_->device(), {slot.fence});
+	slot.pending = false;
+
+	auto completed = std::chrono::duration<double>(Clock::now() - slot.input);
+	latency_.completed.add(1000 * completed.count());
+}
+
+void Renderer::choosePresentMode(vk::SurfaceKHR surface)
+{
+	auto wanted = scInfo_.presentMode;
+	switch(settings_.presentMode) {
+		case PresentMode::automatic: return;
+		case PresentMode::mailbox: wanted = vk::PresentModeKHR::mailbox; break;
+		case PresentMode::immediate: wanted = vk::PresentModeKHR::immediate; break;
+		case PresentMode::fifo: wanted = vk::PresentModeKHR::fifo; break;
+	}
+
+	// fifo is always supported
+	auto& dev = queue_->device();
+	auto modes = vk::getPhysicalDeviceSurfacePresentModesKHR(
+		dev.vkPhysicalDevice(), surface);
+	if(std::find(modes.begin(), modes.end(), wanted) == modes.end()) {
+		dlg_warn("Present mode {} not supported, using fifo",
+			presentModeName(wanted));
+		wanted = vk::PresentModeKHR::fifo;
+	}
+
+	scInfo_.presentMode = wanted;
+}
+
+unsigned int Renderer::chooseWorkGroupSize(const vpp::Device& dev,
+	const vpp::Queue& queue)
+{
+	auto& limits = dev.properties().limits;
+	auto maxSize = std::min(limits.maxComputeWorkGroupSize[0],
+		limits.maxComputeWorkGroupInvocations);
+
+	if(settings_.workGroupSize) {
+		if(settings_.workGroupSize > maxSize) {
+			dlg_warn("Work group size {} not supported, using {}",
+				settings_.workGroupSize, maxSize);
+			return maxSize;
+		}
+
+		return settings_.workGroupSize;
+	}
+
+	auto key = deviceKey(dev.properties());
+	if(!settings_.retune) {
+		auto cached = loadWorkGroupSize(key);
+		if(cached && cached <= maxSize) {
+			dlg_info("Using cached work group size {}", cached);
+			return cached;
+		}
+	}
+
+	std::vector<unsigned int> candidates;
+	for(auto size = 32u; size <= std::min(maxSize, 1024u); size *= 2) {
+		candidates.push_back(size);
+	}
+
+	auto size = tuneWorkGroupSize(dev, queue, candidates);
+	storeWorkGroupSize(key, size);
+	return size;
+}
+
+unsigned int Renderer::tuneWorkGroupSize(const vpp::Device& dev,
+	const vpp::Queue& queue, nytl::Span<const unsigned int> candidates)
+{
+	constexpr auto iterations = 8u;
+
+	if(!queryPool_.vkHandle() || candidates.empty()) {
+		dlg_warn("Cannot tune work group size, using {}", defaultWorkGroupSize);
+		return defaultWorkGroupSize;
+	}
+
+	// a zero time step and no attractors leave the particles untouched.
+	// frameData_ is zero-initialized apart from the count and view.
+	// The particles are not initialized yet and the grid is not built,
+	// so the pipelines are specialized without interaction, lifecycle
+	// and culling. Those would walk the empty grid and append to the
+	// alive list once per dispatch
+	frameData_.particleCount = particleCount_;
+	frameData_.view = view_;
+	if(!pushConstants_) {
+		std::memcpy(uboMap_.ptr(), &frameData_, sizeof(frameData_));
+		if(!uboMap_.coherent()) {
+			uboMap_.flush();
+		}
+	}
+
+	vk::QueryPoolCreateInfo poolInfo;
+	poolInfo.queryType = vk::QueryType::timestamp;
+	poolInfo.queryCount = 2;
+	vpp::QueryPool pool {dev, poolInfo};
+
+	auto cmdBuf = dev.commandAllocator().get(queue.family());
+	auto fence = vpp::Fence {dev};
+
+	vk::MemoryBarrier barrier;
+	barrier.srcAccessMask = vk::AccessBits::shaderWrite;
+	barrier.dstAccessMask = vk::AccessBits::shaderRead |
+		vk::AccessBits::shaderWrite;
+
+	auto best = candidates[0];
+	auto bestTime = std::numeric_limits<double>::max();
+	for(auto size : candidates) {
+		workGroupSize_ = size;
+		auto pipeline = createComputePipeline(dev, *pipelineCache_,
+			compPipelineLayout_, compShader(), size, renderStream_,
+			false, settings_.border, false, false);
+
+		vk::beginCommandBuffer(cmdBuf, {});
+		vk::cmdResetQueryPool(cmdBuf, pool, 0, 2);
+		vk::cmdBindPipeline(cmdBuf, vk::PipelineBindPoint::compute, pipeline);
+		if(pushConstants_) {
+			vk::cmdBindDescriptorSets(cmdBuf, vk::PipelineBindPoint::compute,
+				compPipelineLayout_, 0, {compDescriptor_}, {0u});
+			vk::cmdPushConstants(cmdBuf, compPipelineLayout_,
+				vk::ShaderStageBits::compute, 0, neededUniformSize,
+				&frameData_);
+		} else {
+			vk::cmdBindDescriptorSets(cmdBuf, vk::PipelineBindPoint::compute,
+				compPipelineLayout_, 0, {compDescriptor_}, {0u, 0u});
+		}
+
+		// one additional dispatch to warm up
+		for(auto i = 0u; i < iterations + 1; ++i) {
+			if(i == 1) {
+				vk::cmdWriteTimestamp(cmdBuf, vk::PipelineStageBits::topOfPipe,
+					pool, 0);
+			}
+
+			dispatch(cmdBuf);
+			vk::cmdPipelineBarrier(cmdBuf, vk::PipelineStageBits::computeShader,
+				vk::PipelineStageBits::computeShader, {}, {barrier}, {}, {});
+		}
+
+		vk::cmdWriteTimestamp(cmdBuf, vk::PipelineStageBits::bottomOfPipe, pool, 1);
+		vk::endCommandBuffer(cmdBuf);
+
+		vk::SubmitInfo info;
+		info.commandBufferCount = 1;
+		info.pCommandBuffers = &cmdBuf.vkHandle();
+		vk::queueSubmit(queue.vkHandle(), {info}, fence);
+		vk::waitForFences(dev, {fence}, true, UINT64_MAX);
+		vk::resetFences(dev, {fence});
+
+		std::uint64_t stamps[2];
+		vk::getQueryPoolResults(dev, pool, 0, 2, sizeof(stamps), stamps,
+			sizeof(stamps[0]), vk::QueryResultBits::e64 |
+			vk::QueryResultBits::wait);
+
+		auto ticks = (stamps[1] - stamps[0]) & timestampMask_;
+		auto ms = ticks * timestampPeriod_ * 1e-6 / iterations;
+		dlg_info("Work group size {}: {} ms", size, ms);
+		if(ms < bestTime) {
+			bestTime = ms;
+			best = size;
+		}
+	}
+
+	dlg_info("Using work group size {}", best);
+	return best;
+}
+
+void Renderer::initTimestamps(const vpp::Device& dev, const vpp::Queue& queue)
+{
+	auto validBits = queue.properties().timestampValidBits;
+	if(validBits == 0) {
+		dlg_warn("Queue does not support timestamps, no gpu timings");
+		return;
+	}
+
+	timestampMask_ = validBits >= 64 ? ~std::uint64_t(0) :
+		(std::uint64_t(1) << validBits) - 1;
+	computeTimestampMask_ = timestampMask_;
+	timestampPeriod_ = dev.properties().limits.timestampPeriod;
+
+	vk::QueryPoolCreateInfo info;
+	info.queryType = vk::QueryType::timestamp;
+	info.queryCount = maxTimingSlots * timestampCount;
+	queryPool_ = {dev, info};
+	lastTimestamps_.resize(maxTimingSlots * timestampCount);
+	timestampsWritten_.resize(maxTimingSlots * timestampCount);
+
+	// the command buffers only reset the queries they write. Resetting
+	// all once makes the others unavailable instead of undefined
+	auto cmdBuf = dev.commandAllocator().get(queue.family());
+	vk::beginCommandBuffer(cmdBuf, {});
+	vk::cmdResetQueryPool(cmdBuf, queryPool_, 0, info.queryCount);
+	vk::endCommandBuffer(cmdBuf);
+
+	auto fence = vpp::Fence {dev};
+	vk::SubmitInfo submission;
+	submission.commandBufferCount = 1;
+	submission.pCommandBuffers = &cmdBuf.vkHandle();
+	vk::queueSubmit(queue.vkHandle(), {submission}, fence);
+	vk::waitForFences(dev, {fence}, true, UINT64_MAX);
+}
+
+void Renderer::initOffscreen(const vpp::Device& dev, const vpp::Queue& queue,
+	vk::Extent2D size)
+{
+	offscreen_ = std::make_unique<Offscreen>();
+	offscreen_->queue = &queue;
+	offscreen_->size = size;
+	offscreen_->target = createColorTarget(dev, scInfo_.imageFormat, size,
+		vk::SampleCountBits::e1, vk::ImageUsageBits::colorAttachment |
+		vk::ImageUsageBits::transferSrc);
+
+	// framebuffer, attachment order must match createRenderPass
+	std::vector<vk::ImageView> attachments;
+	if(sampleCount_ != vk::SampleCountBits::e1) {
+		createMultisampleTarget(dev, size);
+		attachments.push_back(multisampleTarget_.vkImageView());
+	}
+
+	attachments.push_back(offscreen_->target.vkImageView());
+
+	vk::FramebufferCreateInfo fbInfo;
+	fbInfo.renderPass = renderPass_;
+	fbInfo.attachmentCount = attachments.size();
+	fbInfo.pAttachments = attachments.data();
+	fbInfo.width = size.width;
+	fbInfo.height = size.height;
+	fbInfo.layers = 1;
+	offscreen_->framebuffer = {dev, fbInfo};
+
+	for(auto i = 0u; i < 2u; ++i) {
+		offscreen_->draw[i] = dev.commandAllocator().get(queue.family());
+		offscreen_->drawData[i] = dev.commandAllocator().get(queue.family());
+
+		vk::FenceCreateInfo fenceInfo;
+		fenceInfo.flags = vk::FenceCreateBits::signaled;
+		offscreen_->fences[i] = {dev, fenceInfo};
+	}
+
+	initDensity(dev, size);
+	recordOffscreen();
+}
+
+void Renderer::recordOffscreen()
+{
+	// with async compute there is one draw command buffer per particle
+	// buffer, the synchronization is done via semaphores
+	auto drawCount = async_ ? 2u : 1u;
+	for(auto i = 0u; i < drawCount; ++i) {
+		recordOffscreen(i);
+	}
+}
+
+void Renderer::recordOffscreen(unsigned int buffer)
+{
+	auto& particles = (buffer == 0) ? particleBuffer_ : async_->particleBuffer;
+	auto& cmdBuf = offscreen_->draw[buffer];
+
+	vk::beginCommandBuffer(cmdBuf, {});
+	if(!async_) {
+		particleBarrier(cmdBuf, vertexBuffer(particles));
+		particleBarrier(cmdBuf, aliveBuffer(particles));
+	}
+
+	recordDraw(cmdBuf, offscreen_->framebuffer, offscreen_->size, buffer,
+		particles);
+	vk::endCommandBuffer(cmdBuf);
+}
+
+FrameTimes Renderer::renderOffscreen()
+{
+	dlg_assert(offscreen_);
+
+	auto& queue = *offscreen_->queue;
+	auto& dev = queue.device();
+	auto frameStart = Clock::now();
+
+	FrameTimes ret;
+	lastGpuTimes_ = {};
+
+	// the draw data is uploaded by a separate command buffer in the
+	// same batch, the draws themselves are never re-recorded
+	if(async_) {
+		// without a simulation step, the current buffer is drawn again.
+		// Like in renderFrame its semaphore is consumed and signaled again
+		auto dst = async_->current;
+		auto wait = &async_->bufferFree[dst];
+		if(substeps_ > 0u) {
+			auto submitStart = Clock::now();
+			dst = submitCompute();
+			wait = &async_->computeDone;
+			ret.submit = std::chrono::duration<double>(Clock::now() - submitStart).count();
+		} else if(!async_->bufferUsed[dst]) {
+			wait = nullptr;
+		}
+
+		auto& fence = offscreen_->fences[dst];
+		vk::waitForFences(dev, {fence}, true, UINT64_MAX);
+		vk::resetFences(dev, {fence});
+		recordDrawData(offscreen_->drawData[dst]);
+
+		vk::PipelineStageFlags waitStage = vk::PipelineStageBits::drawIndirect |
+			vk::PipelineStageBits::vertexInput |
+			vk::PipelineStageBits::computeShader;
+		vk::CommandBuffer cmdBufs[] = {offscreen_->drawData[dst],
+			offscreen_->draw[dst]};
+		vk::SubmitInfo info;
+		info.commandBufferCount = 2;
+		info.pCommandBuffers = cmdBufs;
+		if(wait) {
+			info.waitSemaphoreCount = 1;
+			info.pWaitSemaphores = &wait->vkHandle();
+			info.pWaitDstStageMask = &waitStage;
+		}
+
+		info.signalSemaphoreCount = 1;
+		info.pSignalSemaphores = &async_->bufferFree[dst].vkHandle();
+		vk::queueSubmit(queue.vkHandle(), {info}, fence);
+		async_->bufferUsed[dst] = true;
+		timestampsSubmitted(dst, drawBegin);
+
+		// results of previous frames
+		queryTimings();
+		ret.gpu = lastGpuTimes_;
+		ret.frame = std::chrono::duration<double>(Clock::now() - frameStart).count();
+		return ret;
+	}
+
+	// compute and draw are submitted and timed independently.
+	// The cpu simulation already ran in update
+	auto start = Clock::now();
+	if(cpuSim_) {
+		ret.host.compute = cpuStepTime_;
+	} else if(substeps_ > 0u) {
+		auto& computeFence = computeFrames_[frame_ % uniformSlices].fence;
+		submitCompute();
+		ret.submit = std::chrono::duration<double>(Clock::now() - start).count();
+		vk::waitForFences(dev, {computeFence}, true, UINT64_MAX);
+		ret.host.compute = std::chrono::duration<double>(Clock::now() - start).count();
+	}
+
+	start = Clock::now();
+	auto& fence = offscreen_->fences[0];
+	vk::resetFences(dev, {fence});
+	recordDrawData(offscreen_->drawData[0]);
+
+	vk::CommandBuffer cmdBufs[] = {offscreen_->drawData[0],
+		offscreen_->draw[0]};
+	vk::SubmitInfo info;
+	info.commandBufferCount = 2;
+	info.pCommandBuffers = cmdBufs;
+	vk::queueSubmit(queue.vkHandle(), {info}, fence);
+	timestampsSubmitted(0u, drawBegin);
+	vk::waitForFences(dev, {fence}, true, UINT64_MAX);
+	ret.host.draw = std::chrono::duration<double>(Clock::now() - start).count();
+
+	// the frame is finished, so the queries are available now
+	queryTimings();
+	ret.gpu = lastGpuTimes_;
+	ret.frame = std::chrono::duration<double>(Clock::now() - frameStart).count();
+	return ret;
+}
+
+void Renderer::update(double delta)
+{
+	// the input (points_) was just sampled
+	input_ = Clock::now();
+	queryTimings();
+
+	if(points_.size() > shader::maxAttractors) {
+		dlg_warn("Only {} attractors are supported", shader::maxAttractors);
+		points_.resize(shader::maxAttractors);
+	}
+
+	attractors_.clear();
+	for(auto p : points_) {
+		attractors_.push_back(domainPosition(p));
+	}
+
+	// with a fixed time step, all whole steps accumulated since the
+	// last frame are simulated. Those beyond maxSubsteps_ are dropped,
+	// the simulation slows down instead of falling further behind.
+	// Frames without a step draw the previous state again
+	auto step = delta;
+	substeps_ = 1u;
+	if(fixedStep_ > 0.f) {
+		step = fixedStep_;
+		accumulator_ += delta;
+		auto total = std::floor(accumulator_ / step);
+		accumulator_ -= total * step;
+		substeps_ = static_cast<unsigned int>(std::min<double>(total,
+			maxSubsteps_));
+		extrapolation_ = accumulator_;
+	}
+
+	substepStats_.add(substeps_);
+
+	// the previous frame has finished rendering (renderBlock or
+	// renderOffscreen wait for it) so the particles can be written
+	if(cpuSim_) {
+		auto start = Clock::now();
+		if(substeps_ == 0u) {
+			cpuStepTime_ = 0.0;
+			return;
+		}
+
+		for(auto i = 0u; i < substeps_; ++i) {
+			cpuSim_->step(step, attractors_);
+		}
+
+		auto map = particleBuffer_.memoryMap();
+		auto particles = reinterpret_cast<Particle*>(map.ptr());
+		cpuSim_->store({particles, particleCount_});
+		if(!map.coherent()) {
+			map.flush();
+		}
+
+		liveParticles_ = cpuSim_->live();
+
+		cpuStepTime_ = std::chrono::duration<double>(Clock::now() - start).count();
+		return;
+	}
+
+	// nothing is submitted, see renderFrame
+	if(substeps_ == 0u) {
+		return;
+	}
+
+	// the slice of the next frame was last read by the simulation
+	// submitted uniformSlices frames ago. Usually finished long ago
+	auto slice = frame_ % uniformSlices;
+	auto& dev = queue_->device();
+	vk::waitForFences(dev, {computeFrames_[slice].fence}, true, UINT64_MAX);
+
+	// that simulation also counted the live particles into the slot
+	if(frame_ >= uniformSlices) {
+		if(!liveMap_.coherent()) {
+			liveMap_.invalidate();
+		}
+
+		auto counters = reinterpret_cast<const shader::FrameCounters*>(
+			liveMap_.ptr());
+		liveParticles_ = counters[slice].live;
+		culledParticles_ = counters[slice].culled;
+	}
+
+	auto attractorOffset = slice * attractorSliceSize_;
+	auto ptr = attractorMap_.ptr() + attractorOffset;
+	for(auto a : attractors_) {
+		write(ptr, a);
+	}
+
+	if(!attractorMap_.coherent() && !points_.empty()) {
+		flushMapped(attractorMap_, attractorOffset,
+			points_.size() * sizeof(nytl::Vec2f));
+	}
+
+	if(lifecycle_) {
+		writeEmitters(slice, substeps_ * step);
+	}
+
+	frameData_.deltaT = step;
+	frameData_.attractorCount = points_.size();
+	frameData_.interactionRadius = settings_.interactionRadius;
+	frameData_.frame = frame_;
+	frameData_.particleCount = particleCount_;
+	frameData_.view = view_;
+
+	// the shader checks the bounds for the last group
+	auto dispatchOffset = slice * dispatchSliceSize_;
+	vk::DispatchIndirectCommand groups {};
+	groups.x = (particleCount_ + workGroupSize_ - 1) / workGroupSize_;
+	groups.y = groups.z = 1u;
+	std::memcpy(dispatchMap_.ptr() + dispatchOffset, &groups, sizeof(groups));
+	if(!dispatchMap_.coherent()) {
+		flushMapped(dispatchMap_, dispatchOffset, sizeof(groups));
+	}
+
+	// push constants are baked into the command buffer, it has to be
+	// re-recorded. The uniform buffer slice can just be written
+	if(pushConstants_) {
+		recordComputeFrame(slice, substeps_);
+		return;
+	}
+
+	auto uboOffset = slice * uboSliceSize_;
+	std::memcpy(uboMap_.ptr() + uboOffset, &frameData_, sizeof(frameData_));
+	if(!uboMap_.coherent()) {
+		flushMapped(uboMap_, uboOffset, sizeof(frameData_));
+	}
+}
+
+std::vector<shader::Particle> Renderer::readParticles() const
+{
+	auto& dev = queue_->device();
+	vk::deviceWaitIdle(dev);
+
+	auto size = particleCount_ * particleSize();
+	vk::BufferCreateInfo bufInfo;
+	bufInfo.usage = vk::BufferUsageBits::transferDst;
+	bufInfo.size = size;
+	auto mem = dev.memoryTypeBits(vk::MemoryPropertyBits::hostVisible);
+	vpp::Buffer staging {dev, bufInfo, mem};
+	staging.ensureMemory();
+
+	submitWait(*queue_, [&](vk::CommandBuffer cmdBuf) {
+		vk::cmdCopyBuffer(cmdBuf, drawBuffer(), staging, {{0, 0, size}});
+	});
+
+	auto map = staging.memoryMap();
+	if(!map.coherent()) {
+		map.invalidate();
+	}
+
+	std::vector<Particle> ret(particleCount_);
+	if(!compact_) {
+		std::memcpy(ret.data(), map.ptr(), size);
+		return ret;
+	}
+
+	auto ptr = reinterpret_cast<const shader::CompactParticle*>(map.ptr());
+	for(auto i = 0u; i < particleCount_; ++i) {
+		ret[i] = unpack(ptr[i]);
+	}
+
+	return ret;
+}
+
+void Renderer::createMultisampleTarget(const vpp::Device& dev,
+	const vk::Extent2D& size)
+{
+	if(multisampleWorker_) {
+		releaseWorkerImage(std::move(multisampleTarget_));
+		multisampleWorker_ = false;
+	}
+
+	multisampleTarget_ = createColorTarget(dev, scInfo_.imageFormat, size,
+		sampleCount_, vk::ImageUsageBits::transientAttachment |
+		vk::ImageUsageBits::colorAttachment);
+	multisampleSize_ = size;
+	multisampleSamples_ = sampleCount_;
+}
+
+void Renderer::record(const RenderBuffer& buf)
+{
+	// the command buffer may still be pending from the last frame
+	// that drew to this image. With RecordMode::all only invalidate
+	// re-records, all frames are finished before that
+	auto slot = &buf - renderBuffers_.data();
+	auto& last = bufferFrames_[slot];
+	if(last >= 0 && frameSlots_[last].pending) {
+		auto& frame = frameSlots_[last];
+		vk::waitForFences(device(), {frame.fence}, true, UINT64_MAX);
+		finishFrame(frame);
+	}
+
+	last = frameSlot_;
+	auto cmdBuf = buf.commandBuffer;
+	vk::beginCommandBuffer(cmdBuf, {});
+
+	// the simulation was submitted before. With async compute,
+	// the synchronization is done via semaphores
+	if(!async_) {
+		particleBarrier(cmdBuf, vertexBuffer(particleBuffer_));
+		particleBarrier(cmdBuf, aliveBuffer_);
+	}
+
+	recordDraw(cmdBuf, buf.framebuffer, scInfo_.imageExtent, slot, drawBuffer());
+	vk::endCommandBuffer(cmdBuf);
+
+	// vpp submits the buffer later. Until then its queries are still
+	// unavailable from the reset in initTimestamps and not read
+	timestampsSubmitted(slot, drawBegin);
+}
+
+void Renderer::writeTimestamp(vk::CommandBuffer cmdBuf, int slot,
+	Timestamp stamp, vk::PipelineStageBits stage)
+{
+	if(!queryPool_.vkHandle() || slot < 0 || unsigned(slot) >= maxTimingSlots) {
+		return;
+	}
+
+	auto compute = stamp != drawBegin && stamp != drawEnd;
+	if(compute && !computeTimestampMask_) {
+		return;
+	}
+
+	// compute, draw and sort timestamps are reset independently since
+	// they might be written by different command buffers
+	auto first = slot * timestampCount + stamp;
+	if(stamp == computeBegin || stamp == drawBegin || stamp == sortBegin) {
+		vk::cmdResetQueryPool(cmdBuf, queryPool_, first, 2);
+	}
+
+	vk::cmdWriteTimestamp(cmdBuf, stage, queryPool_, first);
+}
+
+void Renderer::timestampsSubmitted(unsigned int slot, Timestamp begin)
+{
+	if(queryPool_.vkHandle() && slot < maxTimingSlots) {
+		timestampsWritten_[slot * timestampCount + begin] = true;
+	}
+}
+
+void Renderer::dispatch(vk::CommandBuffer cmdBuf)
+{
+	// the shader checks the bounds for the last group
+	auto groups = (particleCount_ + workGroupSize_ - 1) / workGroupSize_;
+	vk::cmdDispatch(cmdBuf, groups, 1, 1);
+}
+
+void Renderer::recordCompute(vk::CommandBuffer cmdBuf, unsigned int slice,
+	unsigned int steps)
+{
+	writeTimestamp(cmdBuf, slice, computeBegin, vk::PipelineStageBits::topOfPipe);
+
+	// simulating in place, the previous frame might still be drawing the
+	// particles and alive list (see waitFrame). Write after read, an
+	// execution dependency is enough. With async compute, the
+	// semaphores order them
+	if(!async_) {
+		vk::cmdPipelineBarrier(cmdBuf,
+			vk::PipelineStageBits::drawIndirect |
+			vk::PipelineStageBits::vertexInput |
+			vk::PipelineStageBits::vertexShader |
+			vk::PipelineStageBits::computeShader,
+			vk::PipelineStageBits::transfer |
+			vk::PipelineStageBits::computeShader, {}, {}, {}, {});
+	}
+
+	// with async compute, frame i simulates from particle buffer i % 2
+	// into (i + 1) % 2, see submitCompute. Further substeps of the
+	// frame simulate the target in place, so the buffers alternate
+	// per frame independent of the number of steps
+	auto source = async_ ? slice % 2 : 0u;
+	auto target = async_ ? (slice + 1) % 2 : 0u;
+	std::uint32_t attractorOffset = slice * attractorSliceSize_;
+	for(auto step = 0u; step < steps; ++step) {
+		auto* set = &compDescriptor_;
+		if(async_ && step == 0u) {
+			set = &async_->descriptors[target];
+		} else if(async_ && target == 1u) {
+			set = &async_->placeDescriptor;
+		}
+
+		if(interaction_) {
+			recordGrid(cmdBuf, step == 0u ? source : target);
+		}
+
+		// the simulation counts the live particles into the slot of
+		// the slice (frame % uniformSlices, see particles.comp) and
+		// appends the alive ones to the alive list of its target.
+		// Only the counts of the last substep remain
+		auto liveOffset = slice * sizeof(shader::FrameCounters);
+		vk::cmdFillBuffer(cmdBuf, liveBuffer_, liveOffset,
+			sizeof(shader::FrameCounters), 0u);
+		if(indexedDraw()) {
+			auto& alive = target ? async_->aliveBuffer : aliveBuffer_;
+			vk::cmdFillBuffer(cmdBuf, alive, 0, sizeof(std::uint32_t), 0u);
+		}
+
+		// the lifetimes and free list were written by the previous step
+		vk::MemoryBarrier clearBarrier;
+		clearBarrier.srcAccessMask = vk::AccessBits::transferWrite |
+			vk::AccessBits::shaderWrite;
+		clearBarrier.dstAccessMask = vk::AccessBits::shaderRead |
+			vk::AccessBits::shaderWrite;
+		vk::cmdPipelineBarrier(cmdBuf,
+			vk::PipelineStageBits::transfer | vk::PipelineStageBits::computeShader,
+			vk::PipelineStageBits::computeShader, {}, {clearBarrier}, {}, {});
+		vk::cmdBindPipeline(cmdBuf, vk::PipelineBindPoint::compute, compPipeline_);
+
+		// dynamic offsets are ordered by binding
+		if(pushConstants_) {
+			vk::cmdBindDescriptorSets(cmdBuf, vk::PipelineBindPoint::compute,
+				compPipelineLayout_, 0, {*set}, {attractorOffset});
+			vk::cmdPushConstants(cmdBuf, compPipelineLayout_,
+				vk::ShaderStageBits::compute, 0, neededUniformSize, &frameData_);
+		} else {
+			std::uint32_t uboOffset = slice * uboSliceSize_;
+			vk::cmdBindDescriptorSets(cmdBuf, vk::PipelineBindPoint::compute,
+				compPipelineLayout_, 0, {*set}, {uboOffset, attractorOffset});
+		}
+
+		// group count and particle count are written per frame in update
+		vk::cmdDispatchIndirect(cmdBuf, dispatchBuffer_,
+			slice * dispatchSliceSize_);
+
+		// the next substep reads the particles and clears the counters
+		// and alive list again
+		if(step + 1 < steps) {
+			vk::MemoryBarrier barrier;
+			barrier.srcAccessMask = vk::AccessBits::shaderWrite;
+			barrier.dstAccessMask = vk::AccessBits::shaderRead |
+				vk::AccessBits::shaderWrite | vk::AccessBits::transferWrite;
+			vk::cmdPipelineBarrier(cmdBuf, vk::PipelineStageBits::computeShader,
+				vk::PipelineStageBits::computeShader |
+				vk::PipelineStageBits::transfer, {}, {barrier}, {}, {});
+		}
+	}
+
+	// the emitters spawn the particles of the whole frame at once
+	if(lifecycle_) {
+		recordEmit(cmdBuf, slice);
+	}
+
+	// the live counter is read on the host after the fence
+	vk::MemoryBarrier barrier;
+	barrier.srcAccessMask = vk::AccessBits::shaderWrite;
+	barrier.dstAccessMask = vk::AccessBits::hostRead;
+	vk::cmdPipelineBarrier(cmdBuf, vk::PipelineStageBits::computeShader,
+		vk::PipelineStageBits::host, {}, {barrier}, {}, {});
+
+	writeTimestamp(cmdBuf, slice, computeEnd, vk::PipelineStageBits::bottomOfPipe);
+}
+
+void Renderer::recordDraw(vk::CommandBuffer cmdBuf, vk::Framebuffer fb,
+	vk::Extent2D size, int slot, const vpp::Buffer& particles)
+{
+	static const auto clearValue = vk::ClearValue {{0.f, 0.f, 0.f, 1.f}};
+	const auto width = size.width;
+	const auto height = size.height;
+
+	// written when all previous compute work has finished.
+	// At top of pipe, it might be written before the simulation is done
+	writeTimestamp(cmdBuf, slot, drawBegin, vk::PipelineStageBits::computeShader);
+	if(splat_) {
+		recordSplat(cmdBuf, particles);
+	}
+
+	vk::cmdBeginRenderPass(cmdBuf, {
+		renderPass_,
+		fb,
+		{0u, 0u, width, height},
+		1,
+		&clearValue
+	}, {});
+
+	vk::Viewport vp {0.f, 0.f, (float) width, (float) height, 0.f, 1.f};
+	vk::cmdSetViewport(cmdBuf, 0, 1, vp);
+	vk::cmdSetScissor(cmdBuf, 0, 1, {0, 0, width, height});
+
+	if(splat_) {
+		vk::cmdBindPipeline(cmdBuf, vk::PipelineBindPoint::graphics,
+			resolvePipeline_);
+		vk::cmdBindDescriptorSets(cmdBuf, vk::PipelineBindPoint::graphics,
+			resolvePipelineLayout_, 0, {resolveDescriptor_}, {});
+		vk::cmdPushConstants(cmdBuf, resolvePipelineLayout_,
+			vk::ShaderStageBits::fragment, 0, sizeof(width), &width);
+		vk::cmdDraw(cmdBuf, 3, 1, 0, 0);
+	} else {
+		vk::cmdBindPipeline(cmdBuf, vk::PipelineBindPoint::graphics, gfxPipeline_);
+		vk::cmdBindVertexBuffers(cmdBuf, 0, {vertexBuffer(particles)}, {0});
+		vk::cmdBindDescriptorSets(cmdBuf, vk::PipelineBindPoint::graphics,
+			gfxPipelineLayout_, 0, {drawDescriptor_}, {});
+
+		// the simulation wrote the draw command. With lifecycle or
+		// culling, the alive list is the index buffer and the command
+		// counts the drawn particles, otherwise it draws the first
+		// particleCount
+		auto& alive = aliveBuffer(particles);
+		if(indexedDraw()) {
+			vk::cmdBindIndexBuffer(cmdBuf, alive, sizeof(shader::DrawCommand),
+				vk::IndexType::uint32);
+			vk::cmdDrawIndexedIndirect(cmdBuf, alive, 0, 1,
+				sizeof(shader::DrawCommand));
+		} else {
+			vk::cmdDrawIndirect(cmdBuf, alive, 0, 1,
+				sizeof(shader::DrawCommand));
+		}
+	}
+
+	vk::cmdEndRenderPass(cmdBuf);
+
+	// includes the msaa resolve at the end of the render pass
+	writeTimestamp(cmdBuf, slot, drawEnd, vk::PipelineStageBits::bottomOfPipe);
+}
+
+void Renderer::recordDrawData(vk::CommandBuffer cmdBuf)
+{
+	shader::DrawData data {};
+	data.view = view_;
+	data.extrapolate = extrapolation_;
+
+	vk::beginCommandBuffer(cmdBuf, {});
+
+	// the draws of the previous frame must have read the old data
+	auto readStages = vk::PipelineStageBits::vertexShader |
+		vk::PipelineStageBits::computeShader;
+	vk::cmdPipelineBarrier(cmdBuf, readStages,
+		vk::PipelineStageBits::transfer, {}, {}, {}, {});
+
+	vk::cmdUpdateBuffer(cmdBuf, drawDataBuffer_, 0, sizeof(data), &data);
+
+	vk::MemoryBarrier barrier;
+	barrier.srcAccessMask = vk::AccessBits::transferWrite;
+	barrier.dstAccessMask = vk::AccessBits::uniformRead;
+	vk::cmdPipelineBarrier(cmdBuf, vk::PipelineStageBits::transfer,
+		readStages, {}, {barrier}, {}, {});
+
+	vk::endCommandBuffer(cmdBuf);
+}
+
+void Renderer::queryTimings()
+{
+	if(!queryPool_.vkHandle()) {
+		return;
+	}
+
+	auto& dev = queryPool_.device();
+	// compute timestamps are written per uniform buffer slice,
+	// draw timestamps per render buffer
+	std::size_t computeSlots = std::min(frame_, uniformSlices);
+	std::size_t drawSlots = renderBuffers_.size();
+	if(headless()) {
+		drawSlots = async_ ? 2u : 1u;
+	}
 
-	if(!pushConstants_) {
-		bufInfo.usage = vk::BufferUsageBits::uniformBuffer;
-		bufInfo.size = neededUniformSize;
-		auto mem = dev.memoryTypeBits(vk::MemoryPropertyBits::hostVisible);
+	// poll all slots without waiting. A slot holds the results of the
+	// last frame it was used for (at least one frame ago), we only take
+	// those not seen before. Compute and draw are read independently
+	auto read = [&](unsigned slot, Timestamp begin, double& ms) {
+		auto compute = begin != drawBegin;
+		auto mask = compute ? computeTimestampMask_ : timestampMask_;
+		if(!mask) {
+			return false;
+		}
 
-		compUbo_ = {dev, bufInfo, mem};
-		compUbo_.ensureMemory();
-	}
+		std::uint64_t stamps[2];
+		auto first = slot * timestampCount + begin;
+		// slots never submitted are skipped, reading them is invalid
+		if(!timestampsWritten_[first]) {
+			return false;
+		}
 
-	// create & upload particles
-	{
-		constexpr auto distrFrom = -0.85f;
-		constexpr auto distrTo = 0.85f;
+		auto res = vk::getQueryPoolResults(dev, queryPool_, first, 2,
+			sizeof(stamps), stamps, sizeof(stamps[0]), vk::QueryResultBits::e64);
+		if(res != vk::Result::success) {
+			return false;
+		}
+
+		auto& last = lastTimestamps_[first];
+		if(stamps[0] == last) {
+			return false;
+		}
 
-		std::mt19937 rgen;
-		rgen.seed(std::time(nullptr));
-		std::uniform_real_distribution<float> distr(distrFrom, distrTo);
+		last = stamps[0];
+		ms = ((stamps[1] - stamps[0]) & mask) * timestampPeriod_ * 1e-6;
+		return true;
+	};
 
-		std::vector<Particle> particles;
-		particles.resize(particleCount_);
-		for(auto i = 0u; i < particleCount_; ++i) {
-			particles[i].pos[0] = distr(rgen);
-			particles[i].pos[1] = distr(rgen);
-			particles[i].vel = {0.f, 0.f};
+	for(auto slot = 0u; slot < maxTimingSlots; ++slot) {
+		double ms;
+		if(slot < computeSlots && read(slot, computeBegin, ms)) {
+			gpuStats_.compute.add(ms);
+			lastGpuTimes_.compute = ms / 1000;
+
+			// the frame ran that many simulation steps
+			auto steps = computeFrames_[slot].substeps;
+			if(steps > 0u) {
+				gpuStats_.substep.add(ms / steps);
+			}
 		}
 
-		vpp::writeStaging430(particleBuffer_, vpp::raw(particles));
-	}
+		if(slot < drawSlots && read(slot, drawBegin, ms)) {
+			gpuStats_.draw.add(ms);
+			lastGpuTimes_.draw = ms / 1000;
+		}
 
-	// write descriptor
-	{
-		vpp::DescriptorSetUpdate update(compDescriptor_);
-		update.storage({{particleBuffer_, 0, vk::wholeSize}});
-		if(!pushConstants_) {
-			update.uniform({{compUbo_, 0, vk::wholeSize}});
+		// only written in the frames that sort
+		if(sortInterval_ && slot < computeSlots && read(slot, sortBegin, ms)) {
+			gpuStats_.sort.add(ms);
+			lastGpuTimes_.sort = ms / 1000;
 		}
 	}
-
-	// init renderer
-	auto mode = pushConstants_ ? RecordMode::always : RecordMode::all;
-	vpp::DefaultRenderer::init(renderPass_, scInfo_, present, {}, mode);
 }
 
-void Renderer::update(double delta)
+void Renderer::resize(nytl::Vec2ui size)
 {
-	auto width = scInfo_.imageExtent.width;
-	auto height = scInfo_.imageExtent.height;
+	// only the last size before the next frame is used
+	pendingSize_ = {size[0], size[1]};
+	resizePending_ = true;
+}
 
-	if(points_.size() > 10) {
-		points_.resize(10);
+void Renderer::applyResize()
+{
+	if(!resizePending_ || !surface_) {
+		return;
 	}
 
-	auto view = compUbo_.memoryMap();
-	auto ptr = view.ptr();
-
-	for(auto p : points_) {
-		dlg_info("p: {}", p);
-		write<float>(ptr, 2 * (p[0] / float(width)) - 1);
-		write<float>(ptr, 2 * (p[1] / float(height)) - 1);
+	// the surface decides the size if it has one, e.g. on android
+	resizePending_ = false;
+	auto& dev = device();
+	auto caps = vk::getPhysicalDeviceSurfaceCapabilitiesKHR(
+		dev.vkPhysicalDevice(), surface_);
+	auto size = pendingSize_;
+	if(caps.currentExtent.width != 0xFFFFFFFFu) {
+		size = caps.currentExtent;
+	} else {
+		size.width = std::clamp(size.width, caps.minImageExtent.width,
+			caps.maxImageExtent.width);
+		size.height = std::clamp(size.height, caps.minImageExtent.height,
+			caps.maxImageExtent.height);
 	}
 
-	ptr = view.ptr() + sizeof(nytl::Vec2f) * 10;
-	write<float>(ptr, delta);
-	write<std::uint32_t>(ptr, points_.size());
-}
+	// e.g. a window drag that ended at the old size
+	auto outdated = swapchainOutdated_;
+	swapchainOutdated_ = false;
+	if(swapchain_.vkHandle() && !outdated &&
+			size.width == scInfo_.imageExtent.width &&
+			size.height == scInfo_.imageExtent.height) {
+		return;
+	}
 
-void Renderer::createMultisampleTarget(const vk::Extent2D& size)
-{
-	auto width = size.width;
-	auto height = size.height;
+	// the frames in flight still use the old swapchain images.
+	// Only they are waited for, not the simulation
+	finishFrames();
 
-	// img
-	vk::ImageCreateInfo img;
-	img.imageType = vk::ImageType::e2d;
-	img.format = scInfo_.imageFormat;
-	img.extent.width = width;
-	img.extent.height = height;
-	img.extent.depth = 1;
-	img.mipLevels = 1;
-	img.arrayLayers = 1;
-	img.sharingMode = vk::SharingMode::exclusive;
-	img.tiling = vk::ImageTiling::optimal;
-	img.samples = sampleCount_;
-	img.usage = vk::ImageUsageBits::transientAttachment | vk::ImageUsageBits::colorAttachment;
-	img.initialLayout = vk::ImageLayout::undefined;
+	// minimized, there is no swapchain until the window has a size
+	// again. The simulation keeps running meanwhile
+	if(!size.width || !size.height) {
+		swapchain_ = {};
+		return;
+	}
 
-	// view
-	vk::ImageViewCreateInfo view;
-	view.viewType = vk::ImageViewType::e2d;
-	view.format = img.format;
-	view.components.r = vk::ComponentSwizzle::r;
-	view.components.g = vk::ComponentSwizzle::g;
-	view.components.b = vk::ComponentSwizzle::b;
-	view.components.a = vk::ComponentSwizzle::a;
-	view.subresourceRange.aspectMask = vk::ImageAspectBits::color;
-	view.subresourceRange.levelCount = 1;
-	view.subresourceRange.layerCount = 1;
+	// the old swapchain is retired by the new one, the presentation
+	// engine can reuse its resources. Destroyed afterwards
+	scInfo_.imageExtent = size;
+	scInfo_.oldSwapchain = swapchain_.vkHandle();
+	vpp::Swapchain swapchain {dev, scInfo_};
+	scInfo_.oldSwapchain = {};
+	swapchain_ = std::move(swapchain);
 
-	// create the viewable image
-	// will set the created image in the view info for us
-	multisampleTarget_ = {device(), img, view};
+	createBuffers(size, scInfo_.imageFormat);
+	invalidate();
+	dlg_info("Swapchain size {}x{}", size.width, size.height);
 }
 
-void Renderer::record(const RenderBuffer& buf)
+void Renderer::warmUpPipelines(const vpp::Device& dev,
+	vk::ImageLayout finalLayout)
 {
-	static const auto clearValue = vk::ClearValue {{0.f, 0.f, 0.f, 1.f}};
-	const auto width = scInfo_.imageExtent.width;
-	const auto height = scInfo_.imageExtent.height;
+	// the render pass and graphics pipelines depend on the sample count.
+	// The variants for the other ones are built on the cache worker and
+	// kept, switching (see applySamples) then only has to swap them in.
+	// The layouts are destroyed after the cache, which finishes the task
+	auto supported = dev.properties().limits.framebufferColorSampleCounts;
+	auto current = sampleCount_;
+	auto format = scInfo_.imageFormat;
+	auto compact = compact_;
+	auto renderStream = renderStream_;
+	vk::PipelineCache cache = *pipelineCache_;
+	vk::PipelineLayout gfxLayout = gfxPipelineLayout_;
+	vk::PipelineLayout resolveLayout = resolvePipelineLayout_;
+	auto shared = sampleSwitch_.get();
+
+	pipelineCache_->enqueue([=, &dev]{
+		auto start = Clock::now();
+		const vk::SampleCountBits counts[] = {
+			vk::SampleCountBits::e1,
+			vk::SampleCountBits::e2,
+			vk::SampleCountBits::e4,
+			vk::SampleCountBits::e8,
+		};
+
+		for(auto samples : counts) {
+			if(samples == current || !(supported & samples)) {
+				continue;
+			}
+
+			SampleVariant variant;
+			variant.samples = samples;
+			variant.format = format;
+			variant.renderPass = createRenderPass(dev, format, samples,
+				finalLayout);
+			variant.gfxPipeline = createGraphicsPipeline(dev, cache, compact,
+				renderStream, variant.renderPass, gfxLayout, samples);
+			variant.resolvePipeline = createResolvePipeline(dev, cache,
+				variant.renderPass, resolveLayout, samples);
+
+			std::lock_guard<std::mutex> lock(shared->mutex);
+			shared->variants.push_back(std::move(variant));
+		}
 
-	auto cmdBuf = buf.commandBuffer;
-	vk::beginCommandBuffer(cmdBuf, {});
+		auto ms = std::chrono::duration<double, std::milli>(Clock::now() - start);
+		dlg_info("Built the other sample count pipelines in {} ms", ms.count());
+	});
 
-	// compute
-	vk::cmdBindPipeline(cmdBuf, vk::PipelineBindPoint::compute, compPipeline_);
-	vk::cmdBindDescriptorSets(cmdBuf, vk::PipelineBindPoint::compute,
-		compPipelineLayout_, 0, {compDescriptor_}, {});
-	vk::cmdDispatch(cmdBuf, particleCount_ / 16, 1, 1);
+	pipelineCache_->save();
+}
 
-	// TODO: barrier or stuff
+bool Renderer::samples(vk::SampleCountBits samples)
+{
+	dlg_assert(!headless());
+
+	auto& dev = device();
+	auto supported = dev.properties().limits.framebufferColorSampleCounts;
+	if(!(supported & samples)) {
+		dlg_warn("{} samples are not supported by the device",
+			static_cast<unsigned int>(samples));
+		return false;
+	}
 
-	// render pass
-	vk::cmdBeginRenderPass(cmdBuf, {
-		renderPass(),
-		buf.framebuffer,
-		{0u, 0u, width, height},
-		1,
-		&clearValue
-	}, {});
+	dlg_info("Switching to {} samples", static_cast<unsigned int>(samples));
+	requestedSamples_ = samples;
+	requestSampleTarget();
+	return true;
+}
 
-	vk::Viewport vp {0.f, 0.f, (float) width, (float) height, 0.f, 1.f};
-	vk::cmdSetViewport(cmdBuf, 0, 1, vp);
-	vk::cmdSetScissor(cmdBuf, 0, 1, {0, 0, width, height});
+void Renderer::requestSampleTarget()
+{
+	// one request at a time, a stale one is requested again
+	// in applySamples
+	if(sampleTargetPending_) {
+		return;
+	}
 
-	vk::cmdBindPipeline(cmdBuf, vk::PipelineBindPoint::graphics, gfxPipeline_);
-	vk::cmdBindVertexBuffers(cmdBuf, 0, {particleBuffer_}, {0});
-	vk::cmdDraw(cmdBuf, particleCount_, 1, 0, 0);
+	sampleTargetPending_ = true;
+	auto& dev = device();
+	auto samples = requestedSamples_;
+	auto size = scInfo_.imageExtent;
+	auto format = scInfo_.imageFormat;
+	auto shared = sampleSwitch_.get();
+
+	// runs after the warm up, so the variant exists afterwards.
+	// Allocates on the worker thread, vpp's allocators are per thread
+	pipelineCache_->enqueue([=, &dev]{
+		SampleTarget target {samples, format, size, {}};
+		if(samples != vk::SampleCountBits::e1) {
+			target.image = createColorTarget(dev, format, size, samples,
+				vk::ImageUsageBits::transientAttachment |
+				vk::ImageUsageBits::colorAttachment);
+		}
 
-	vk::cmdEndRenderPass(cmdBuf);
-	vk::endCommandBuffer(cmdBuf);
+		std::lock_guard<std::mutex> lock(shared->mutex);
+		shared->target = std::move(target);
+	});
 }
 
-void Renderer::resize(nytl::Vec2ui size)
+void Renderer::releaseWorkerImage(vpp::ViewableImage image)
 {
-	vpp::DefaultRenderer::resize({size[0], size[1]}, scInfo_);
+	// it was allocated on the worker thread and is destroyed there,
+	// the worker might allocate from the same allocator meanwhile.
+	// std::function must be copyable
+	if(!image.vkImageView()) {
+		return;
+	}
+
+	auto shared = std::make_shared<vpp::ViewableImage>(std::move(image));
+	pipelineCache_->enqueue([shared]{
+		*shared = {};
+	});
 }
 
-void Renderer::samples(vk::SampleCountBits samples)
+void Renderer::applySamples()
 {
-	sampleCount_ = samples;
-	if(sampleCount_ != vk::SampleCountBits::e1) {
-		createMultisampleTarget(scInfo_.imageExtent);
+	// without swapchain, the switch waits for the next one
+	if(!sampleTargetPending_ || !swapchain_.vkHandle()) {
+		return;
+	}
+
+	std::optional<SampleTarget> target;
+	{
+		// variants for the format of a previous surface are dropped
+		std::lock_guard<std::mutex> lock(sampleSwitch_->mutex);
+		for(auto& variant : sampleSwitch_->variants) {
+			if(variant.format == scInfo_.imageFormat) {
+				sampleVariants_.push_back(std::move(variant));
+			}
+		}
+
+		sampleSwitch_->variants.clear();
+		if(!sampleSwitch_->target) {
+			return;
+		}
+
+		target = std::move(sampleSwitch_->target);
+		sampleSwitch_->target.reset();
+	}
+
+	sampleTargetPending_ = false;
+	if(requestedSamples_ == sampleCount_) {
+		releaseWorkerImage(std::move(target->image));
+		return;
+	}
+
+	// the request, size or format changed while it was built
+	auto size = scInfo_.imageExtent;
+	if(target->samples != requestedSamples_ ||
+			target->format != scInfo_.imageFormat ||
+			target->size.width != size.width ||
+			target->size.height != size.height) {
+		releaseWorkerImage(std::move(target->image));
+		requestSampleTarget();
+		return;
+	}
+
+	auto it = std::find_if(sampleVariants_.begin(), sampleVariants_.end(),
+		[&](auto& variant) {
+			return variant.samples == target->samples &&
+				variant.format == scInfo_.imageFormat;
+		});
+	if(it == sampleVariants_.end()) {
+		dlg_warn("No pipelines built for {} samples, creating them now",
+			static_cast<unsigned int>(target->samples));
+
+		auto& dev = device();
+		SampleVariant variant;
+		variant.samples = target->samples;
+		variant.format = scInfo_.imageFormat;
+		variant.renderPass = createRenderPass(dev, scInfo_.imageFormat,
+			variant.samples, vk::ImageLayout::presentSrcKHR);
+		variant.gfxPipeline = createGraphicsPipeline(dev, *pipelineCache_,
+			compact_, renderStream_, variant.renderPass, gfxPipelineLayout_,
+			variant.samples);
+		variant.resolvePipeline = createResolvePipeline(dev, *pipelineCache_,
+			variant.renderPass, resolvePipelineLayout_, variant.samples);
+		sampleVariants_.push_back(std::move(variant));
+		it = sampleVariants_.end() - 1;
 	}
 
-	renderPass_ = createRenderPass(device(), scInfo_.imageFormat, samples);
+	// the frames in flight still use the old framebuffers and
+	// attachment. Only they are waited for, at most framesInFlight
+	finishFrames();
+
+	// the current variant is kept for switching back
+	std::swap(it->samples, sampleCount_);
+	std::swap(it->renderPass, renderPass_);
+	std::swap(it->gfxPipeline, gfxPipeline_);
+	std::swap(it->resolvePipeline, resolvePipeline_);
 	vpp::DefaultRenderer::renderPass_ = renderPass_;
-	gfxPipeline_ = createGraphicsPipeline(device(), renderPass_,
-		gfxPipelineLayout_, sampleCount_);
+
+	if(multisampleWorker_) {
+		releaseWorkerImage(std::move(multisampleTarget_));
+	}
+
+	multisampleTarget_ = std::move(target->image);
+	multisampleWorker_ = true;
+	multisampleSize_ = target->size;
+	multisampleSamples_ = target->samples;
 
 	initBuffers(scInfo_.imageExtent, renderBuffers_);
 	invalidate();
+	dlg_info("Using {} samples", static_cast<unsigned int>(sampleCount_));
 }
 
 void Renderer::initBuffers(const vk::Extent2D& size,
 	nytl::Span<RenderBuffer> bufs)
 {
+	if(size.width != densitySize_.width || size.height != densitySize_.height) {
+		initDensity(device(), size);
+	}
+
+	// a target built in the background (see applySamples) is reused
+	auto targetValid = multisampleSamples_ == sampleCount_ &&
+		multisampleSize_.width == size.width &&
+		multisampleSize_.height == size.height;
 	if(sampleCount_ != vk::SampleCountBits::e1) {
-		createMultisampleTarget(scInfo_.imageExtent);
+		if(!targetValid) {
+			createMultisampleTarget(device(), size);
+		}
+
 		vpp::DefaultRenderer::initBuffers(size, bufs,
 			{multisampleTarget_.vkImageView()});
 	} else {
 		vpp::DefaultRenderer::initBuffers(size, bufs, {});
 	}
+
+	fitFrameSlots(bufs.size());
+	bufferFrames_.assign(bufs.size(), -1);
+}
+
+void Renderer::fitFrameSlots(std::size_t images)
+{
+	// every image has only one command buffer, more frames
+	// than images can't be in flight (see record). The uniform buffer
+	// slices are only guarded by the compute fences
+	auto count = std::clamp<std::size_t>(settings_.framesInFlight, 1u,
+		std::min<std::size_t>(uniformSlices, images));
+	if(count == frameSlots_.size()) {
+		return;
+	}
+
+	finishFrames();
+	auto& dev = device();
+	auto old = frameSlots_.size();
+	frameSlots_.resize(count);
+	for(auto i = old; i < count; ++i) {
+		frameSlots_[i].fence = {dev};
+		frameSlots_[i].drawData = dev.commandAllocator().get(queue_->family());
+	}
+
+	frameSlot_ %= count;
+	if(count < std::min<std::size_t>(uniformSlices, settings_.framesInFlight)) {
+		dlg_info("{} frames in flight with {} swapchain images", count, images);
+	}
 }
 
 void Renderer::surfaceDestroyed()
 {
-	wait();
+	// the simulation submitted after the frames keeps running
+	finishFrames();
 	swapchain_ = {};
+	surface_ = {};
 }
 
 void Renderer::surfaceCreated(vk::SurfaceKHR surface)
 {
-	// TODO: size
-	// TODO: we can not really assume that format and everything stays
-	// the same and should probably recreate pipeline and renderPass
-	scInfo_ = vpp::swapchainCreateInfo(present_->device(),
-		surface, scInfo_.imageExtent);
-	swapchain_ = {present_->device(), scInfo_};
-	createBuffers(scInfo_.imageExtent, scInfo_.imageFormat);
-	invalidate();
+	// the swapchain is created at the start of the next frame,
+	// with the size of the surface (see applyResize)
+	auto& dev = device();
+	auto format = scInfo_.imageFormat;
+	scInfo_ = vpp::swapchainCreateInfo(dev, surface, scInfo_.imageExtent);
+	choosePresentMode(surface);
+	surface_ = surface;
+	pendingSize_ = scInfo_.imageExtent;
+	resizePending_ = true;
+
+	if(scInfo_.imageFormat == format) {
+		return;
+	}
+
+	// the render pass and graphics pipelines depend on the format.
+	// The variants of the other sample counts are built again, the old
+	// ones and a multisample target are dropped (see applySamples)
+	dlg_info("Surface format changed, recreating the pipelines");
+	finishFrames();
+	renderPass_ = createRenderPass(dev, scInfo_.imageFormat, sampleCount_,
+		vk::ImageLayout::presentSrcKHR);
+	vpp::DefaultRenderer::renderPass_ = renderPass_;
+	gfxPipeline_ = createGraphicsPipeline(dev, *pipelineCache_, compact_,
+		renderStream_, renderPass_, gfxPipelineLayout_, sampleCount_);
+	resolvePipeline_ = createResolvePipeline(dev, *pipelineCache_,
+		renderPass_, resolvePipelineLayout_, sampleCount_);
+
+	multisampleSize_ = {};
+	sampleVariants_.clear();
+	warmUpPipelines(dev, vk::ImageLayout::presentSrcKHR);
 }
 
 // utility
+void submitWait(const vpp::Queue& queue,
+	const std::function<void(vk::CommandBuffer)>& record)
+{
+	auto& dev = queue.device();
+	auto cmdBuf = dev.commandAllocator().get(queue.family());
+	vk::beginCommandBuffer(cmdBuf, {});
+	record(cmdBuf);
+	vk::endCommandBuffer(cmdBuf);
+
+	vpp::Fence fence {dev};
+	vk::SubmitInfo info;
+	info.commandBufferCount = 1;
+	info.pCommandBuffers = &cmdBuf.vkHandle();
+	vk::queueSubmit(queue.vkHandle(), {info}, fence);
+	vk::waitForFences(dev, {fence}, true, UINT64_MAX);
+}
+
+const char* presentModeName(vk::PresentModeKHR mode)
+{
+	switch(mode) {
+		case vk::PresentModeKHR::immediate: return "immediate";
+		case vk::PresentModeKHR::mailbox: return "mailbox";
+		case vk::PresentModeKHR::fifo: return "fifo";
+		case vk::PresentModeKHR::fifoRelaxed: return "fifo relaxed";
+		default: return "unknown";
+	}
+}
+
+// Converts a ieee 754 half float to float.
+float halfToFloat(std::uint16_t half)
+{
+	std::uint32_t sign = (half & 0x8000u) << 16;
+	std::uint32_t exp = (half >> 10) & 0x1Fu;
+	std::uint32_t mant = half & 0x3FFu;
+
+	float ret;
+	if(exp == 0) { // zero or denormalized
+		ret = std::ldexp(float(mant), -24);
+		return sign ? -ret : ret;
+	}
+
+	std::uint32_t bits;
+	if(exp == 31) { // inf or nan
+		bits = sign | 0x7F800000u | (mant << 13);
+	} else {
+		bits = sign | ((exp + 112) << 23) | (mant << 13);
+	}
+
+	std::memcpy(&ret, &bits, sizeof(ret));
+	return ret;
+}
+
+Particle unpack(const shader::CompactParticle& p)
+{
+	auto snorm = [](std::uint32_t bits) {
+		auto value = float(std::int16_t(bits & 0xFFFFu)) / 32767.f;
+		return std::max(value, -1.f);
+	};
+
+	Particle ret;
+	ret.pos[0] = shader::positionRange * snorm(p.pos);
+	ret.pos[1] = shader::positionRange * snorm(p.pos >> 16);
+	ret.vel[0] = halfToFloat(p.vel & 0xFFFFu);
+	ret.vel[1] = halfToFloat(p.vel >> 16);
+	return ret;
+}
+
+void flushMapped(const vpp::MemoryMapView& view, vk::DeviceSize offset,
+	vk::DeviceSize size)
+{
+	auto& dev = view.memory().device();
+	auto atom = dev.properties().limits.nonCoherentAtomSize;
+	auto start = view.offset() + offset;
+	auto alignedStart = (start / atom) * atom;
+	auto end = start + size;
+
+	vk::MappedMemoryRange range;
+	range.memory = view.memory();
+	range.offset = alignedStart;
+	range.size = ((end - alignedStart + atom - 1) / atom) * atom;
+	vk::flushMappedMemoryRanges(dev, {range});
+}
+
+vpp::Buffer createStorageBuffer(const vpp::Device& dev, vk::DeviceSize size,
+	vk::BufferUsageFlags usage, nytl::Span<const std::uint32_t> families)
+{
+	vk::BufferCreateInfo bufInfo;
+	bufInfo.usage = vk::BufferUsageBits::storageBuffer | usage;
+	bufInfo.size = size;
+	if(!families.empty()) {
+		bufInfo.sharingMode = vk::SharingMode::concurrent;
+		bufInfo.queueFamilyIndexCount = families.size();
+		bufInfo.pQueueFamilyIndices = families.data();
+	}
+
+	auto mem = dev.memoryTypeBits(vk::MemoryPropertyBits::deviceLocal);
+	vpp::Buffer buf = {dev, bufInfo, mem};
+	buf.ensureMemory();
+	return buf;
+}
+
+void particleBarrier(vk::CommandBuffer cmdBuf, vk::Buffer particles)
+{
+	// makes the particle writes from the simulation visible to the
+	// vertex input stage or the splat shader. Also used for the
+	// alive list, read as index buffer and indirect draw command
+	vk::BufferMemoryBarrier barrier;
+	barrier.srcAccessMask = vk::AccessBits::shaderWrite;
+	barrier.dstAccessMask = vk::AccessBits::vertexAttributeRead |
+		vk::AccessBits::indexRead | vk::AccessBits::indirectCommandRead |
+		vk::AccessBits::shaderRead;
+	barrier.srcQueueFamilyIndex = vk::queueFamilyIgnored;
+	barrier.dstQueueFamilyIndex = vk::queueFamilyIgnored;
+	barrier.buffer = particles;
+	barrier.size = vk::wholeSize;
+	vk::cmdPipelineBarrier(cmdBuf,
+		vk::PipelineStageBits::computeShader,
+		vk::PipelineStageBits::drawIndirect | vk::PipelineStageBits::vertexInput |
+			vk::PipelineStageBits::computeShader,
+		{}, {}, {barrier}, {});
+}
+
 vpp::Pipeline createGraphicsPipeline(const vpp::Device& device,
-	vk::RenderPass renderPass, vk::PipelineLayout layout, vk::SampleCountBits sampleCount)
+	vk::PipelineCache cache, bool compact,
+	bool renderStream, vk::RenderPass renderPass, vk::PipelineLayout layout,
+	vk::SampleCountBits sampleCount)
 {
 	// auto msaa = sampleCount != vk::SampleCountBits::e1;
-	auto vertex = vpp::ShaderModule(device, particles_vert_data);
+	auto vertex = renderStream ?
+		vpp::ShaderModule(device, particles_stream_vert_data) :
+		vpp::ShaderModule(device, particles_vert_data);
 	auto fragment = vpp::ShaderModule(device, particles_frag_data);
 
 	vpp::ShaderProgram stages({
@@ -324,24 +3376,49 @@ vpp::Pipeline createGraphicsPipeline(const vpp::Device& device,
 	pipeInfo.renderPass = renderPass;
 	pipeInfo.layout = layout;
 
-	pipeInfo.stageCount = stages.vkStageInfos().size();
-	pipeInfo.pStages = stages.vkStageInfos().data();
-
-	constexpr auto stride = sizeof(float) * 4; // vec2 pos, velocity
+	// positionScale
+	vk::SpecializationMapEntry entry {0, 0, sizeof(float)};
+	float positionScale = compact ? shader::positionRange : 1.f;
+
+	vk::SpecializationInfo spec;
+	spec.mapEntryCount = 1;
+	spec.pMapEntries = &entry;
+	spec.dataSize = sizeof(positionScale);
+	spec.pData = &positionScale;
+
+	auto stageInfos = stages.vkStageInfos();
+	stageInfos[0].pSpecializationInfo = &spec;
+	pipeInfo.stageCount = stageInfos.size();
+	pipeInfo.pStages = stageInfos.data();
+
+	// vec2 pos, velocity. Normalized position and half float
+	// velocity in the compact format
+	std::uint32_t stride = compact ?
+		sizeof(shader::CompactParticle) : sizeof(shader::Particle);
 	vk::VertexInputBindingDescription bufferBinding {0, stride, vk::VertexInputRate::vertex};
 
 	// vertex position attribute
 	vk::VertexInputAttributeDescription attributes[2];
-	attributes[0].format = vk::Format::r32g32Sfloat;
+	attributes[0].format = compact ?
+		vk::Format::r16g16Snorm : vk::Format::r32g32Sfloat;
 
-	attributes[1].format = vk::Format::r32g32Sfloat;
+	attributes[1].format = compact ?
+		vk::Format::r16g16Sfloat : vk::Format::r32g32Sfloat;
 	attributes[1].location = 1;
-	attributes[1].offset = sizeof(float) * 2;
+	attributes[1].offset = stride / 2;
+
+	// the render stream is a single packed uint per particle
+	auto attributeCount = 2u;
+	if(renderStream) {
+		bufferBinding.stride = sizeof(std::uint32_t);
+		attributes[0].format = vk::Format::r32Uint;
+		attributeCount = 1u;
+	}
 
 	vk::PipelineVertexInputStateCreateInfo vertexInfo;
 	vertexInfo.vertexBindingDescriptionCount = 1;
 	vertexInfo.pVertexBindingDescriptions = &bufferBinding;
-	vertexInfo.vertexAttributeDescriptionCount = 2;
+	vertexInfo.vertexAttributeDescriptionCount = attributeCount;
 	vertexInfo.pVertexAttributeDescriptions = attributes;
 	pipeInfo.pVertexInputState = &vertexInfo;
 
@@ -395,51 +3472,157 @@ vpp::Pipeline createGraphicsPipeline(const vpp::Device& device,
 	dynamicInfo.pDynamicStates = dynStates.begin();
 	pipeInfo.pDynamicState = &dynamicInfo;
 
-	// setup cache
-	constexpr auto cacheName = "graphicsCache.bin";
-	vpp::PipelineCache cache {device, cacheName};
-
 	vk::Pipeline ret;
 	vk::createGraphicsPipelines(device, cache, 1, pipeInfo, nullptr, ret);
-
-	try {
-		vpp::save(cache, cacheName);
-	} catch(const std::exception& err) {
-		dlg_warn("vpp::save(PipelineCache): {}", err.what());
-	}
-
 	return {device, ret};
 }
 
 vpp::Pipeline createComputePipeline(const vpp::Device& device,
-	vk::PipelineLayout layout)
+	vk::PipelineCache cache, vk::PipelineLayout layout,
+	nytl::Span<const std::uint32_t> spirv, unsigned int workGroupSize,
+	bool renderStream, bool interaction,
+	unsigned int border, bool lifecycle, bool cull)
 {
-	auto computeShader = vpp::ShaderModule(device, particles_comp_data);
+	auto computeShader = vpp::ShaderModule(device, spirv);
+
+	// local_size_x, renderStream, interaction, borderPolicy, lifecycle,
+	// cull (ignored by shaders without them)
+	vk::SpecializationMapEntry entries[6] {
+		{0, 0, sizeof(std::uint32_t)},
+		{1, sizeof(std::uint32_t), sizeof(vk::Bool32)},
+		{2, 2 * sizeof(std::uint32_t), sizeof(vk::Bool32)},
+		{3, 3 * sizeof(std::uint32_t), sizeof(std::uint32_t)},
+		{4, 4 * sizeof(std::uint32_t), sizeof(vk::Bool32)},
+		{5, 5 * sizeof(std::uint32_t), sizeof(vk::Bool32)}
+	};
+	std::uint32_t data[6] = {workGroupSize, renderStream, interaction,
+		border, lifecycle, cull};
+
+	vk::SpecializationInfo spec;
+	spec.mapEntryCount = 6;
+	spec.pMapEntries = entries;
+	spec.dataSize = sizeof(data);
+	spec.pData = data;
 
 	vk::ComputePipelineCreateInfo info;
 	info.layout = layout;
 	info.stage.module = computeShader;
 	info.stage.pName = "main";
 	info.stage.stage = vk::ShaderStageBits::compute;
-
-	constexpr auto cacheName = "computeCache.bin";
-
-	vpp::PipelineCache cache {device, cacheName};
+	info.stage.pSpecializationInfo = &spec;
 
 	vk::Pipeline vkPipeline;
 	vk::createComputePipelines(device, cache, 1, info, nullptr, vkPipeline);
+	return {device, vkPipeline};
+}
 
-	try {
-		vpp::save(cache, cacheName);
-	} catch(const std::exception& err) {
-		dlg_warn("vpp::save(PipelineCache): {}", err.what());
-	}
+vpp::Pipeline createResolvePipeline(const vpp::Device& device,
+	vk::PipelineCache cache, vk::RenderPass renderPass, vk::PipelineLayout layout,
+	vk::SampleCountBits sampleCount)
+{
+	auto vertex = vpp::ShaderModule(device, fullscreen_vert_data);
+	auto fragment = vpp::ShaderModule(device, resolve_frag_data);
 
-	return {device, vkPipeline};
+	vpp::ShaderProgram stages({
+		{vertex, vk::ShaderStageBits::vertex},
+		{fragment, vk::ShaderStageBits::fragment}
+	});
+
+	vk::GraphicsPipelineCreateInfo pipeInfo;
+	pipeInfo.renderPass = renderPass;
+	pipeInfo.layout = layout;
+
+	auto stageInfos = stages.vkStageInfos();
+	pipeInfo.stageCount = stageInfos.size();
+	pipeInfo.pStages = stageInfos.data();
+
+	// the fullscreen triangle is generated in the vertex shader
+	vk::PipelineVertexInputStateCreateInfo vertexInfo;
+	pipeInfo.pVertexInputState = &vertexInfo;
+
+	vk::PipelineInputAssemblyStateCreateInfo assemblyInfo;
+	assemblyInfo.topology = vk::PrimitiveTopology::triangleList;
+	pipeInfo.pInputAssemblyState = &assemblyInfo;
+
+	vk::PipelineRasterizationStateCreateInfo rasterizationInfo;
+	rasterizationInfo.polygonMode = vk::PolygonMode::fill;
+	rasterizationInfo.cullMode = vk::CullModeBits::none;
+	rasterizationInfo.frontFace = vk::FrontFace::counterClockwise;
+	rasterizationInfo.lineWidth = 1.f;
+	pipeInfo.pRasterizationState = &rasterizationInfo;
+
+	vk::PipelineMultisampleStateCreateInfo multisampleInfo;
+	multisampleInfo.rasterizationSamples = sampleCount;
+	pipeInfo.pMultisampleState = &multisampleInfo;
+
+	// writes the final color, no blending
+	vk::PipelineColorBlendAttachmentState blendAttachment;
+	blendAttachment.blendEnable = false;
+	blendAttachment.colorWriteMask =
+		vk::ColorComponentBits::r |
+		vk::ColorComponentBits::g |
+		vk::ColorComponentBits::b |
+		vk::ColorComponentBits::a;
+
+	vk::PipelineColorBlendStateCreateInfo blendInfo;
+	blendInfo.attachmentCount = 1;
+	blendInfo.pAttachments = &blendAttachment;
+	pipeInfo.pColorBlendState = &blendInfo;
+
+	vk::PipelineViewportStateCreateInfo viewportInfo;
+	viewportInfo.scissorCount = 1;
+	viewportInfo.viewportCount = 1;
+	pipeInfo.pViewportState = &viewportInfo;
+
+	const auto dynStates = {vk::DynamicState::viewport, vk::DynamicState::scissor};
+
+	vk::PipelineDynamicStateCreateInfo dynamicInfo;
+	dynamicInfo.dynamicStateCount = dynStates.size();
+	dynamicInfo.pDynamicStates = dynStates.begin();
+	pipeInfo.pDynamicState = &dynamicInfo;
+
+	vk::Pipeline ret;
+	vk::createGraphicsPipelines(device, cache, 1, pipeInfo, nullptr, ret);
+	return {device, ret};
+}
+
+vpp::ViewableImage createColorTarget(const vpp::Device& dev, vk::Format format,
+	vk::Extent2D size, vk::SampleCountBits samples, vk::ImageUsageFlags usage)
+{
+	// img
+	vk::ImageCreateInfo img;
+	img.imageType = vk::ImageType::e2d;
+	img.format = format;
+	img.extent.width = size.width;
+	img.extent.height = size.height;
+	img.extent.depth = 1;
+	img.mipLevels = 1;
+	img.arrayLayers = 1;
+	img.sharingMode = vk::SharingMode::exclusive;
+	img.tiling = vk::ImageTiling::optimal;
+	img.samples = samples;
+	img.usage = usage;
+	img.initialLayout = vk::ImageLayout::undefined;
+
+	// view
+	vk::ImageViewCreateInfo view;
+	view.viewType = vk::ImageViewType::e2d;
+	view.format = img.format;
+	view.components.r = vk::ComponentSwizzle::r;
+	view.components.g = vk::ComponentSwizzle::g;
+	view.components.b = vk::ComponentSwizzle::b;
+	view.components.a = vk::ComponentSwizzle::a;
+	view.subresourceRange.aspectMask = vk::ImageAspectBits::color;
+	view.subresourceRange.levelCount = 1;
+	view.subresourceRange.layerCount = 1;
+
+	// create the viewable image
+	// will set the created image in the view info for us
+	return {dev, img, view};
 }
 
-vpp::RenderPass createRenderPass(const vpp::Device& dev,
-	vk::Format format, vk::SampleCountBits sampleCount)
+vpp::RenderPass createRenderPass(const vpp::Device& dev, vk::Format format,
+	vk::SampleCountBits sampleCount, vk::ImageLayout finalLayout)
 {
 	vk::AttachmentDescription attachments[2] {};
 	auto msaa = sampleCount != vk::SampleCountBits::e1;
@@ -454,7 +3637,7 @@ vpp::RenderPass createRenderPass(const vpp::Device& dev,
 		attachments[0].stencilLoadOp = vk::AttachmentLoadOp::dontCare;
 		attachments[0].stencilStoreOp = vk::AttachmentStoreOp::dontCare;
 		attachments[0].initialLayout = vk::ImageLayout::undefined;
-		attachments[0].finalLayout = vk::ImageLayout::presentSrcKHR;
+		attachments[0].finalLayout = finalLayout;
 
 		swapchainID = 1u;
 	}
@@ -468,7 +3651,7 @@ vpp::RenderPass createRenderPass(const vpp::Device& dev,
 	attachments[swapchainID].stencilLoadOp = vk::AttachmentLoadOp::dontCare;
 	attachments[swapchainID].stencilStoreOp = vk::AttachmentStoreOp::dontCare;
 	attachments[swapchainID].initialLayout = vk::ImageLayout::undefined;
-	attachments[swapchainID].finalLayout = vk::ImageLayout::presentSrcKHR;
+	attachments[swapchainID].finalLayout = finalLayout;
 
 	// refs
 	vk::AttachmentReference colorReference;
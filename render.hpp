@@ -16,32 +16,325 @@
 #include <vpp/sync.hpp>
 #include <vpp/queue.hpp>
 #include <vpp/vk.hpp> // FIXME
+#include <vpp/queryPool.hpp> // vpp::QueryPool
+#include <vpp/memoryMap.hpp> // vpp::MemoryMapView
 #include <nytl/vec.hpp>
+#include <stats.hpp> // RollingStats
+#include <settings.hpp> // RendererSettings
+#include <shaders/particles.h> // shader::FrameData
+#include <cpuSimulation.hpp> // CpuSimulation
+#include <pipelineCache.hpp> // PipelineCache
+
+#include <memory> // std::unique_ptr
+#include <chrono> // std::chrono::high_resolution_clock
+#include <mutex> // std::mutex
+#include <optional> // std::optional
 
 class Engine;
 
+/// Durations of the simulation and the draw part of a frame in seconds.
+/// Negative if not available. The sort time is only available on the
+/// gpu and only in frames that sorted the particles.
+struct StageTimes {
+	double compute {-1.0};
+	double draw {-1.0};
+	double sort {-1.0};
+};
+
+/// Timings of a single headless frame.
+/// Host times are measured from submission until the respective fence
+/// was signaled, gpu times are taken from timestamp queries.
+/// The frame time is the host time spent in Renderer::renderOffscreen.
+/// The update time is the host time spent in Renderer::update (writing
+/// the frame data or re-recording), the submit time the host time of
+/// submitting the simulation.
+struct FrameTimes {
+	StageTimes host;
+	StageTimes gpu;
+	double frame {-1.0};
+	double update {-1.0};
+	double submit {-1.0};
+};
+
+/// Rolling statistics over the gpu timestamp results in milliseconds.
+/// Results are read back a few frames delayed, without stalling.
+/// Substep is the compute time divided by the number of simulation
+/// steps of the frame (see RendererSettings::fixedStep).
+struct GpuStats {
+	RollingStats compute;
+	RollingStats draw;
+	RollingStats sort;
+	RollingStats substep;
+};
+
+/// Rolling statistics of the latency between sampling the input
+/// (Renderer::update) and presenting the frame, in milliseconds.
+/// Queued is measured until the present was queued, completed until
+/// all work of the frame was seen finished. The fences are polled in
+/// Renderer::waitFrame, so completed is an upper bound.
+struct LatencyStats {
+	RollingStats queued;
+	RollingStats completed;
+};
+
 class Renderer : public vpp::DefaultRenderer {
 public:
 	std::vector<nytl::Vec2f> points_ {};
 
+	/// Emitter positions in normalized device coordinates, at most
+	/// shader::maxEmitters. Only used with RendererSettings::emitters.
+	std::vector<nytl::Vec2f> emitters_ {};
+
 public:
 	Renderer() = default;
+
+	/// The compute queue is only used for async compute and may be null.
 	Renderer(const vpp::Device&, vk::SurfaceKHR, vk::SampleCountBits samples,
-		const vpp::Queue& present);
+		const vpp::Queue& present, const vpp::Queue* compute = {},
+		const RendererSettings& = {});
+
+	/// Creates the renderer in headless mode.
+	/// Does not create a swapchain but renders into an offscreen image
+	/// of the given size instead. Frames can only be rendered with
+	/// renderOffscreen, the vpp::DefaultRenderer interface must not be used.
+	Renderer(const vpp::Device&, vk::Extent2D size, vk::SampleCountBits samples,
+		const vpp::Queue& queue, const vpp::Queue* compute = {},
+		const RendererSettings& = {});
 	~Renderer() = default;
 
 	Renderer(Renderer&&) noexcept = default;
 	Renderer& operator=(Renderer&&) noexcept = default;
 
 	void update(double delta);
+
+	/// Requests a swapchain of the given size. It is recreated at the
+	/// start of the next frame (see renderFrame), from the old one, so
+	/// a burst of resize events only recreates it once.
 	void resize(nytl::Vec2ui size);
-	void samples(vk::SampleCountBits);
 
+	/// Requests switching to the given sample count. Returns false if
+	/// the device does not support it for color attachments. The pipelines
+	/// and the multisample target are built in the background, the switch
+	/// happens at the start of a later frame (see renderFrame).
+	bool samples(vk::SampleCountBits);
+	vk::SampleCountBits samples() const { return sampleCount_; }
+
+	/// Changes the number of particles without recreating the renderer.
+	/// Existing particles are kept, new ones are spawned randomly
+	/// (deterministic for a given seed). With emitters, this is the
+	/// size of the particle pool and all particles are freed.
+	/// Waits for the device to become idle.
+	void particleCount(unsigned int count);
+
+	/// Switches between drawing the particles as points and splatting
+	/// them into a density buffer with a compute shader, which is then
+	/// resolved in a fullscreen pass. Both show the same scene.
+	void splat(bool);
+	bool splat() const { return splat_; }
+
+	/// Zooms the view by the given factor, keeping the given window
+	/// position fixed. Clamped to [shader::minZoom, shader::maxZoom].
+	void zoom(float factor, nytl::Vec2f pos);
+
+	/// Moves the view by the given delta in window coordinates.
+	void pan(nytl::Vec2f delta);
+	void resetView();
+
+	/// View transform of the drawn particles, see shader::View.
+	/// Uploaded with the draw data every frame, changing it does not
+	/// re-record anything.
+	const shader::View& view() const { return view_; }
+
+	/// Simulation domain position at the given window position.
+	nytl::Vec2f domainPosition(nytl::Vec2f pos) const;
+
+	/// Destroys the swapchain, only waits for the frames in flight.
+	/// Until a surface is created again, renderFrame only simulates.
 	void surfaceDestroyed();
+
+	/// Uses the given surface from the next frame on. Recreates the
+	/// render pass and pipelines if its format differs.
 	void surfaceCreated(vk::SurfaceKHR surface);
 
+	/// Simulates and renders one frame to the swapchain.
+	/// Does not wait for the frame to finish (except for the cpu
+	/// simulation, which writes the particles on the host), at most
+	/// RendererSettings::framesInFlight frames (and not more than the
+	/// swapchain has images) are pending.
+	/// Without a surface or with a zero size, only simulates.
+	void renderFrame();
+
+	/// Blocks until less than RendererSettings::framesInFlight frames
+	/// are pending. Call before sampling the input of the next frame,
+	/// renderFrame waits as well otherwise.
+	void waitFrame();
+	const LatencyStats& latency() const { return latency_; }
+	vk::PresentModeKHR presentMode() const { return scInfo_.presentMode; }
+
+	/// Whether the last frame had a swapchain to present to. False
+	/// without a surface or while the window is minimized.
+	bool presenting() const { return swapchain_.vkHandle(); }
+
+	/// Simulates and renders one frame into the offscreen target.
+	/// Only valid in headless mode. Blocks until the frame is finished,
+	/// except with async compute where it only waits for the frame
+	/// before the last one. Host stage times are not available then.
+	FrameTimes renderOffscreen();
+
+	/// Returns the gpu timing statistics. Empty if the queue does not
+	/// support timestamps.
+	const GpuStats& gpuStats() const { return gpuStats_; }
+
+	bool headless() const { return offscreen_ != nullptr; }
+	bool asyncCompute() const { return async_ != nullptr; }
+	bool pushConstants() const { return pushConstants_; }
+	bool compactParticles() const { return compact_; }
+
+	/// Size of a single particle in the particle buffers in bytes.
+	std::size_t particleSize() const { return compact_ ?
+		sizeof(shader::CompactParticle) : sizeof(shader::Particle); }
+
+	/// Size of the vertex input per particle in bytes.
+	std::size_t vertexSize() const { return renderStream_ ?
+		sizeof(std::uint32_t) : particleSize(); }
+
+	/// Whether the particles are drawn from the packed render stream
+	/// written by the simulation (see RendererSettings::renderStream).
+	bool renderStream() const { return renderStream_; }
+	bool cpuSimulation() const { return cpuSim_ != nullptr; }
+
+	/// Number of frames between sorting the particles by screen tile,
+	/// 0 if they are never sorted.
+	unsigned int sortInterval() const { return sortInterval_; }
+
+	/// Whether the particles interact with each other (see
+	/// RendererSettings::interactionRadius).
+	bool interaction() const { return interaction_; }
+
+	/// Number of particles inside [-1, 1], see RendererSettings::border.
+	/// Counted by the simulation and read back when its slice is reused,
+	/// i.e. up to uniformSlices frames old.
+	std::size_t liveParticles() const { return liveParticles_; }
+
+	/// Whether the particles are spawned by emitters with a lifetime
+	/// (see RendererSettings::emitters).
+	bool lifecycle() const { return lifecycle_; }
+	std::size_t emitterCount() const { return emitters_.size(); }
+
+	/// Whether the particles outside [-1, 1] are culled before
+	/// drawing (see RendererSettings::cull).
+	bool cull() const { return cull_; }
+
+	/// Number of alive particles the last culling left out, counted
+	/// like liveParticles. Always zero without culling.
+	std::size_t culledParticles() const { return culledParticles_; }
+
+	/// Whether only a stochastic subset of the particles is drawn when
+	/// zoomed out (see RendererSettings::lod).
+	bool lod() const { return lod_; }
+
+	/// Fixed simulation time step in seconds, zero if the simulation
+	/// uses the frame delta (see RendererSettings::fixedStep).
+	float fixedStep() const { return fixedStep_; }
+
+	/// Number of simulation steps of the last update, at most
+	/// RendererSettings::maxSubsteps. Always one without a fixed step.
+	unsigned int substeps() const { return substeps_; }
+
+	/// Rolling statistics of the simulation steps per frame.
+	const RollingStats& substepStats() const { return substepStats_; }
+
+	/// Attractor positions of the last update in normalized device
+	/// coordinates, as passed to the simulation.
+	const std::vector<nytl::Vec2f>& attractors() const { return attractors_; }
+
+	/// Copies the current particle state back from the gpu.
+	/// Waits for the device to be idle, only meant for validation.
+	std::vector<shader::Particle> readParticles() const;
+	unsigned int workGroupSize() const { return workGroupSize_; }
+	unsigned int particleCount() const { return particleCount_; }
+
 protected:
-	void createMultisampleTarget(const vk::Extent2D& size);
+	// timestamp queries written per timing slot
+	enum Timestamp {
+		computeBegin,
+		computeEnd,
+		drawBegin,
+		drawEnd,
+		sortBegin,
+		sortEnd,
+		timestampCount
+	};
+
+	void initResources(const vpp::Device&, const vpp::Queue&, vk::Format,
+		vk::ImageLayout);
+	void initTimestamps(const vpp::Device&, const vpp::Queue&);
+	void initOffscreen(const vpp::Device&, const vpp::Queue&, vk::Extent2D);
+	bool checkAsync(const vpp::Queue& gfx, const vpp::Queue* compute);
+	void initAsync(const vpp::Device&, const vpp::Queue& gfx,
+		const vpp::Queue& compute);
+	void initCompute(const vpp::Device&);
+	void warmUpPipelines(const vpp::Device&, vk::ImageLayout finalLayout);
+	void requestSampleTarget();
+	void releaseWorkerImage(vpp::ViewableImage);
+	void applySamples();
+	void applyResize();
+	void simulateFrame();
+	void recordCompute();
+	void recordComputeFrame(unsigned int slice, unsigned int steps);
+	nytl::Span<const std::uint32_t> compShader() const;
+	void recordOffscreen();
+	void recordOffscreen(unsigned int buffer);
+	vpp::Buffer createParticleBuffer(const vpp::Device&) const;
+	vpp::Buffer createStreamBuffer(const vpp::Device&) const;
+
+	// the buffer to draw the given particle buffer from
+	const vpp::Buffer& vertexBuffer(const vpp::Buffer& particles) const;
+	void initParticles(const vpp::Buffer&, unsigned int first,
+		unsigned int count);
+	void writeCompDescriptors();
+	void writeCompDescriptor(const vpp::DescriptorSet&, const vpp::Buffer& in,
+		const vpp::Buffer& out);
+	void initSplat(const vpp::Device&);
+	void initDensity(const vpp::Device&, vk::Extent2D size);
+	void writeSplatDescriptors();
+	void recordSplat(vk::CommandBuffer, const vpp::Buffer& particles);
+	void initSort(const vpp::Device&);
+	void writeSortDescriptors();
+	void recordSort(vk::CommandBuffer, unsigned int slice);
+	void initGrid(const vpp::Device&);
+	void writeGridDescriptors();
+	void recordGrid(vk::CommandBuffer, unsigned int source);
+	void initEmit(const vpp::Device&);
+	void initAliveLists();
+	void writeEmitDescriptors();
+	void recordEmit(vk::CommandBuffer, unsigned int slice);
+	void writeEmitters(unsigned int slice, double delta);
+
+	// the alive list of the given particle buffer
+	const vpp::Buffer& aliveBuffer(const vpp::Buffer& particles) const;
+	vpp::Buffer createAliveBuffer(const vpp::Device&) const;
+
+	// dispatches the bound pipeline over all particles in chunks,
+	// pushing {first, count} of the chunk at the given offset
+	void dispatchChunks(vk::CommandBuffer, vk::PipelineLayout,
+		std::uint32_t pushOffset);
+	unsigned int submitCompute();
+	const vpp::Buffer& drawBuffer() const;
+	void createMultisampleTarget(const vpp::Device&, const vk::Extent2D& size);
+	void writeTimestamp(vk::CommandBuffer, int slot, Timestamp,
+		vk::PipelineStageBits);
+	void timestampsSubmitted(unsigned int slot, Timestamp begin);
+	unsigned int chooseWorkGroupSize(const vpp::Device&, const vpp::Queue&);
+	unsigned int tuneWorkGroupSize(const vpp::Device&, const vpp::Queue&,
+		nytl::Span<const unsigned int> candidates);
+	void dispatch(vk::CommandBuffer);
+	void recordCompute(vk::CommandBuffer, unsigned int slice,
+		unsigned int steps);
+	void recordDraw(vk::CommandBuffer, vk::Framebuffer, vk::Extent2D, int slot,
+		const vpp::Buffer& particles);
+	void recordDrawData(vk::CommandBuffer);
+	void queryTimings();
 	void record(const RenderBuffer&) override;
 	void initBuffers(const vk::Extent2D&, nytl::Span<RenderBuffer>) override;
 
@@ -49,23 +342,251 @@ protected:
 	vpp::Pipeline gfxPipeline_;
 	vpp::PipelineLayout gfxPipelineLayout_;
 
+	// shader::DrawData, read by the vertex and splat shaders. Uploaded
+	// on the graphics queue before every frame, see recordDrawData
+	vpp::Buffer drawDataBuffer_;
+	vpp::DescriptorSetLayout drawDescriptorLayout_;
+	vpp::DescriptorSet drawDescriptor_;
+
 	vpp::Pipeline compPipeline_;
 	vpp::PipelineLayout compPipelineLayout_;
 
+	vpp::Pipeline initPipeline_;
+	vpp::PipelineLayout initPipelineLayout_;
+	vpp::DescriptorSetLayout initDescriptorLayout_;
+	vpp::DescriptorSet initDescriptor_;
+	std::uint32_t seed_ {};
+
 	vpp::ViewableImage multisampleTarget_;
+	vk::Extent2D multisampleSize_ {}; // of multisampleTarget_
+	vk::SampleCountBits multisampleSamples_ {vk::SampleCountBits::e1};
+	bool multisampleWorker_ {}; // allocated on the worker, see applySamples
 	vpp::RenderPass renderPass_;
 	vk::SampleCountBits sampleCount_;
 	vk::SwapchainCreateInfoKHR scInfo_;
+	RendererSettings settings_;
+
+	// the swapchain is recreated at the start of a frame, see applyResize.
+	// Null surface while there is none (android in the background)
+	vk::SurfaceKHR surface_ {};
+	vk::Extent2D pendingSize_ {};
+	bool resizePending_ {};
+	bool swapchainOutdated_ {}; // reported when rendering the last frame
+	unsigned int workGroupSize_ {};
 
 	bool pushConstants_ {false};
-	// unsigned int particleCount_ {350000}; // android
-	// unsigned int particleCount_ {3000000}; // main pc
-	unsigned int particleCount_ {750000};
+	bool compact_ {false}; // particles stored as shader::CompactParticle
+	bool renderStream_ {false}; // draw from streamBuffer_
+	shader::FrameData frameData_ {}; // push constant data of the frame
+	const vpp::Queue* queue_ {}; // graphics queue
+	unsigned int particleCount_ {};
+	unsigned int particleCapacity_ {}; // size of the particle buffers
 	vpp::Buffer particleBuffer_;
+	vpp::Buffer streamBuffer_; // render stream written when simulating particleBuffer_
 	vpp::Buffer compUbo_;
+	vpp::MemoryMapView uboMap_; // persistent mapping of compUbo_
+	vk::DeviceSize uboSliceSize_ {}; // size of one frame in compUbo_
+	vpp::Buffer attractorBuffer_; // ring of attractor positions
+	vpp::MemoryMapView attractorMap_;
+	vk::DeviceSize attractorSliceSize_ {}; // one frame in attractorBuffer_
+	vpp::Buffer liveBuffer_; // shader::FrameCounters per slice
+	vpp::MemoryMapView liveMap_;
+	std::size_t liveParticles_ {};
+	std::size_t culledParticles_ {};
+	vpp::Buffer dispatchBuffer_; // ring of simulation dispatch arguments
+	vpp::MemoryMapView dispatchMap_;
+	vk::DeviceSize dispatchSliceSize_ {}; // one frame in dispatchBuffer_
 	vpp::DescriptorPool descriptorPool_;
 	vpp::DescriptorSetLayout gfxDescriptorLayout_;
 	vpp::DescriptorSetLayout compDescriptorLayout_;
 	vpp::DescriptorSet gfxDescriptor_;
 	vpp::DescriptorSet compDescriptor_;
+
+	// splat rendering, see splat.comp and resolve.frag
+	bool splat_ {false};
+	vpp::Pipeline splatPipeline_;
+	vpp::PipelineLayout splatPipelineLayout_;
+	vpp::DescriptorSetLayout splatDescriptorLayout_;
+	vpp::DescriptorSet splatDescriptor_; // splats particleBuffer_
+	vpp::Pipeline resolvePipeline_;
+	vpp::PipelineLayout resolvePipelineLayout_;
+	vpp::DescriptorSetLayout resolveDescriptorLayout_;
+	vpp::DescriptorSet resolveDescriptor_;
+	vpp::Buffer densityBuffer_; // two uints per pixel
+	vk::Extent2D densitySize_ {};
+
+	// sorting by screen tile, see sort.comp
+	unsigned int sortInterval_ {}; // in frames, 0 if disabled
+	vpp::Pipeline sortCountPipeline_;
+	vpp::Pipeline sortScanPipeline_;
+	vpp::Pipeline sortScatterPipeline_;
+	vpp::PipelineLayout sortPipelineLayout_;
+	vpp::DescriptorSetLayout sortDescriptorLayout_;
+	vpp::DescriptorSet sortDescriptor_; // sorts particleBuffer_
+	vpp::Buffer sortBuffer_; // the sorted particles before copying back
+	vpp::Buffer binBuffer_; // shader::sortBins uints
+
+	// spatial hash for the particle interaction, see grid.comp
+	bool interaction_ {false};
+	vpp::Pipeline gridCountPipeline_;
+	vpp::Pipeline gridScanPipeline_;
+	vpp::Pipeline gridScatterPipeline_;
+	vpp::PipelineLayout gridPipelineLayout_;
+	vpp::DescriptorSetLayout gridDescriptorLayout_;
+	vpp::DescriptorSet gridDescriptor_; // hashes particleBuffer_
+	vpp::Buffer cellBuffer_; // particle positions sorted by bin
+	vpp::Buffer cellEndBuffer_; // shader::gridHashSize uints
+
+	// particle lifecycle, see emit.comp
+	bool lifecycle_ {false};
+	vpp::Pipeline emitPipeline_;
+	vpp::PipelineLayout emitPipelineLayout_;
+	vpp::DescriptorSetLayout emitDescriptorLayout_;
+	vpp::DescriptorSet emitDescriptor_; // spawns into particleBuffer_
+	vpp::Buffer lifetimeBuffer_; // float per particle, <= 0 if dead
+	vpp::Buffer freeListBuffer_; // int count, free slots
+	vpp::Buffer aliveBuffer_; // draw command, alive slots of particleBuffer_
+	vpp::Buffer emitterBuffer_; // ring of emitter headers and emitters
+	vpp::MemoryMapView emitterMap_;
+	vk::DeviceSize emitterSliceSize_ {}; // one frame in emitterBuffer_
+	double spawnDebt_ {}; // fractional particles not yet spawned
+
+	// the simulation only appends the visible particles to the alive
+	// list, see particles.comp. Also drawn through the alive list then
+	bool cull_ {false};
+	bool indexedDraw() const { return lifecycle_ || cull_; }
+
+	// view transform, uploaded for the vertex and splat shaders and
+	// passed to the simulation for the culling and level of detail
+	shader::View view_ {{0.f, 0.f}, 1.f, 1.f};
+	bool lod_ {false};
+	void viewChanged();
+
+	// fixed time step simulation, see update. The drawn positions are
+	// extrapolated by the accumulated time not yet simulated
+	float fixedStep_ {}; // in seconds, 0 if the frame delta is used
+	unsigned int maxSubsteps_ {1};
+	double accumulator_ {}; // time not yet simulated
+	unsigned int substeps_ {1}; // of the current frame
+	float extrapolation_ {}; // in seconds, uploaded for the draw shaders
+	RollingStats substepStats_;
+
+	// frame pacing with the swapchain, see waitFrame
+	struct FrameSlot {
+		vpp::Fence fence; // signaled when all work of the frame finished
+		vpp::CommandBuffer drawData; // see recordDrawData
+		bool pending {};
+		std::chrono::high_resolution_clock::time_point input;
+	};
+
+	std::vector<FrameSlot> frameSlots_;
+	unsigned int frameSlot_ {}; // used by the next frame
+	// the slot that last recorded each render buffer, -1 for none
+	std::vector<int> bufferFrames_;
+	std::chrono::high_resolution_clock::time_point input_; // of the last update
+	LatencyStats latency_;
+	void finishFrame(FrameSlot&);
+	void finishFrames();
+	void fitFrameSlots(std::size_t images);
+	void choosePresentMode(vk::SurfaceKHR);
+
+	// sample count switching, see samples. The render pass and pipelines
+	// of the other sample counts and the multisample target for a
+	// request are built on the pipeline cache worker. They are taken
+	// over in applySamples at the start of a frame
+	struct SampleVariant {
+		vk::SampleCountBits samples;
+		vk::Format format; // of the surface, may change with it
+		vpp::RenderPass renderPass;
+		vpp::Pipeline gfxPipeline;
+		vpp::Pipeline resolvePipeline;
+	};
+
+	struct SampleTarget {
+		vk::SampleCountBits samples;
+		vk::Format format;
+		vk::Extent2D size;
+		vpp::ViewableImage image; // empty for a single sample
+	};
+
+	// written by the worker
+	struct SampleSwitch {
+		std::mutex mutex;
+		std::vector<SampleVariant> variants;
+		std::optional<SampleTarget> target;
+	};
+
+	std::unique_ptr<SampleSwitch> sampleSwitch_;
+	std::vector<SampleVariant> sampleVariants_; // not in use
+	vk::SampleCountBits requestedSamples_ {};
+	bool sampleTargetPending_ {}; // requested from the worker
+
+	// queue families accessing the particle buffers concurrently.
+	// Empty if only used by one family
+	std::vector<std::uint32_t> queueFamilies_;
+
+	// timing
+	// one slot of timestampCount queries per render buffer
+	vpp::QueryPool queryPool_;
+	std::vector<std::uint64_t> lastTimestamps_; // per slot and stage
+	std::vector<bool> timestampsWritten_; // per slot and stage, see queryTimings
+	float timestampPeriod_ {}; // nanoseconds per tick
+	std::uint64_t timestampMask_ {};
+	std::uint64_t computeTimestampMask_ {}; // of the compute queue, 0 if none
+	GpuStats gpuStats_;
+	StageTimes lastGpuTimes_;
+
+	// only used in headless mode
+	struct Offscreen {
+		const vpp::Queue* queue;
+		vk::Extent2D size;
+		vpp::ViewableImage target;
+		vpp::Framebuffer framebuffer;
+		vpp::CommandBuffer draw[2]; // per particle buffer with async compute
+		vpp::CommandBuffer drawData[2]; // submitted with draw, see recordDrawData
+		vpp::Fence fences[2];
+	};
+
+	// only used with async compute
+	// simulates from one particle buffer into the other one
+	struct AsyncCompute {
+		const vpp::Queue* queue;
+		vpp::Buffer particleBuffer; // second particle buffer
+		vpp::Buffer streamBuffer; // render stream of particleBuffer
+		vpp::DescriptorSet descriptors[2]; // [i] simulates into buffer i
+		vpp::DescriptorSet placeDescriptor; // simulates particleBuffer in place
+		vpp::DescriptorSet splatDescriptor; // splats particleBuffer
+		vpp::DescriptorSet sortDescriptor; // sorts particleBuffer
+		vpp::DescriptorSet gridDescriptor; // hashes particleBuffer
+		vpp::DescriptorSet emitDescriptor; // spawns into particleBuffer
+		vpp::Buffer aliveBuffer; // alive list of particleBuffer
+		vpp::Semaphore computeDone;
+		vpp::Semaphore bufferFree[2]; // signaled when rendering buffer i is done
+		bool bufferUsed[2] {}; // whether bufferFree[i] will be signaled
+		unsigned int current {}; // buffer holding the latest state
+	};
+
+	// simulation command buffers, one per uniform buffer slice.
+	// Frame i uses slice i % computeFrames_.size(). The command
+	// buffers [i] run i + 1 simulation steps
+	struct ComputeFrame {
+		std::vector<vpp::CommandBuffer> commandBuffers;
+		std::vector<vpp::CommandBuffer> sortCommandBuffers; // simulate and sort
+		vpp::Fence fence; // signaled when the simulation has finished
+		unsigned int substeps {}; // of the last submission
+	};
+
+	std::vector<ComputeFrame> computeFrames_;
+	std::size_t frame_ {}; // number of submitted simulation frames
+
+	std::unique_ptr<Offscreen> offscreen_;
+	std::unique_ptr<AsyncCompute> async_;
+
+	std::unique_ptr<CpuSimulation> cpuSim_;
+	double cpuStepTime_ {-1.0}; // seconds, of the last cpu simulation step
+	std::vector<nytl::Vec2f> attractors_; // normalized device coordinates
+
+	// shared by all pipelines. Last member: destroyed first, its worker
+	// might still use the pipeline layouts (see warmUpPipelines)
+	std::unique_ptr<PipelineCache> pipelineCache_;
 };
@@ -0,0 +1,126 @@
+// Copyright (c) 2017 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+#include <nytl/vec.hpp>
+#include <string> // std::string
+#include <cstdint> // std::uint32_t
+
+/// Swapchain present modes. Automatic keeps the one vpp chooses.
+enum class PresentMode {
+	automatic,
+	mailbox, // no tearing, the latest frame replaces queued ones
+	immediate, // might tear, lowest latency
+	fifo, // vsync, always supported
+};
+
+/// Renderer settings that are chosen at startup.
+struct RendererSettings {
+	// initial number of particles, can be changed at runtime.
+	// About 350000 work well on android, 3000000 on desktop gpus
+	unsigned int particleCount {750000};
+
+	// seed for the initial particle positions. Random if zero
+	std::uint32_t seed {0};
+
+	// simulate on a dedicated compute queue, overlapping with the
+	// rendering of the previous frame. Falls back to the synchronous
+	// path if there is no such queue
+	bool asyncCompute {false};
+
+	// work group size of the simulation. 0 means to use the size
+	// cached for the device or to find the fastest one on startup
+	unsigned int workGroupSize {0};
+	bool retune {false}; // ignore the cached work group size
+
+	// pass the per-frame simulation data as push constants instead of
+	// a uniform buffer. Re-records the simulation every frame
+	bool pushConstants {false};
+
+	// store the particles as shader::CompactParticle (8 instead of
+	// 16 bytes), trading precision for memory bandwidth
+	bool compactParticles {false};
+
+	// the simulation additionally writes a packed 4 byte render stream
+	// (quantized position and speed) that is drawn instead of the particles
+	bool renderStream {false};
+
+	// draw by splatting the particles into a density buffer with a
+	// compute shader instead of rasterizing points. Can be toggled
+	// at runtime (Renderer::splat)
+	bool splat {false};
+
+	// sort the particles by screen tile (morton order) every
+	// sortInterval frames, improving the cache locality when drawing.
+	// Disabled if zero
+	unsigned int sortInterval {0};
+
+	// particles closer than this (in normalized device coordinates)
+	// push each other away. The neighbours are found through a spatial
+	// hash that is rebuilt every frame. Disabled if zero
+	float interactionRadius {0.f};
+
+	// what happens to particles leaving the screen ([-1, 1]), one of
+	// the border constants in particles.h (shader::borderWrap etc.).
+	// Particles that just leave still cost simulation and vertex work
+	unsigned int border {0};
+
+	// number of emitters spawning particles with a limited lifetime
+	// (see emit.comp). particleCount is then the size of the pool they
+	// are spawned into, only the alive ones are drawn. Disabled if zero
+	unsigned int emitters {0};
+	float emitRate {50000.f}; // particles per second and emitter
+	float emitSpeed {0.5f}; // initial speed, randomized down to half
+	float lifetime {2.f}; // in seconds, randomized down to half
+
+	// the simulation only appends particles inside [-1, 1] to an index
+	// list that is drawn indirectly, the others skip the vertex shader.
+	// Only affects rasterizing points
+	bool cull {false};
+
+	// initial zoom of the view, changed with the mouse wheel at runtime
+	float zoom {1.f};
+
+	// level of detail: when zoomed out, only draw a stochastic subset
+	// of zoom^2 of the particles, about as many per pixel as unzoomed
+	bool lod {false};
+
+	// simulate with a fixed time step (seconds) instead of the frame
+	// delta. Every frame runs the whole steps that accumulated, at most
+	// maxSubsteps (the rest is dropped), in one submission. Drawing
+	// extrapolates the positions by the remaining time. Disabled if zero
+	float fixedStep {0.f};
+	unsigned int maxSubsteps {4};
+
+	// simulate on the cpu instead (see CpuSimulation). The particles are
+	// written into host visible memory every frame
+	bool cpuSimulation {false};
+
+	// number of frames the cpu may submit ahead of the gpu when rendering
+	// to a window (see Renderer::waitFrame). The input is sampled after
+	// waiting for the oldest one, so fewer frames mean less latency but
+	// less overlap of cpu and gpu work
+	unsigned int framesInFlight {2};
+	PresentMode presentMode {PresentMode::automatic};
+};
+
+/// Startup settings, parsed from the command line.
+struct EngineSettings {
+	bool headless {false}; // no window, renders offscreen and runs benchmark
+	nytl::Vec2ui size {1100, 800}; // window or offscreen target size
+	unsigned int samples {1}; // initial msaa sample count
+
+	unsigned int frames {1000}; // number of benchmark frames
+	float delta {1 / 60.f}; // fixed benchmark time step in seconds
+	std::string benchOutput {}; // csv file for per-frame times, optional
+	unsigned int attractors {2}; // number of scripted benchmark attractors
+	bool validate {false}; // compare gpu and cpu simulation instead
+
+	// adapts the particle count to hold this frame time (milliseconds).
+	// Disabled if zero
+	float targetFrameTime {0.f};
+
+	RendererSettings renderer {};
+};
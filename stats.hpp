@@ -0,0 +1,71 @@
+// Copyright (c) 2017 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+#pragma once
+
+#include <vector> // std::vector
+#include <algorithm> // std::min_element
+#include <numeric> // std::accumulate
+#include <cstddef> // std::size_t
+
+/// Keeps the last `capacity` samples of a value and computes simple
+/// statistics over them. When full, the oldest sample gets replaced.
+class RollingStats {
+public:
+	RollingStats(std::size_t capacity = 256) : capacity_(capacity) {
+		samples_.reserve(capacity);
+	}
+
+	void add(double value) {
+		if(samples_.size() < capacity_) {
+			samples_.push_back(value);
+		} else {
+			samples_[next_] = value;
+			next_ = (next_ + 1) % capacity_;
+		}
+	}
+
+	void clear() {
+		samples_.clear();
+		next_ = 0u;
+	}
+
+	std::size_t count() const { return samples_.size(); }
+	double last() const {
+		if(samples_.empty()) return 0.0;
+		auto id = samples_.size() < capacity_ ? samples_.size() : next_;
+		return samples_[(id + capacity_ - 1) % capacity_];
+	}
+
+	double min() const {
+		if(samples_.empty()) return 0.0;
+		return *std::min_element(samples_.begin(), samples_.end());
+	}
+
+	double max() const {
+		if(samples_.empty()) return 0.0;
+		return *std::max_element(samples_.begin(), samples_.end());
+	}
+
+	double avg() const {
+		if(samples_.empty()) return 0.0;
+		auto sum = std::accumulate(samples_.begin(), samples_.end(), 0.0);
+		return sum / samples_.size();
+	}
+
+	/// Returns the value below which the given fraction of samples lie,
+	/// e.g. percentile(0.99) for the p99 value.
+	double percentile(double fraction) const {
+		if(samples_.empty()) return 0.0;
+		auto sorted = samples_;
+		auto id = std::min<std::size_t>(fraction * sorted.size(), sorted.size() - 1);
+		std::nth_element(sorted.begin(), sorted.begin() + id, sorted.end());
+		return sorted[id];
+	}
+
+protected:
+	std::vector<double> samples_;
+	std::size_t capacity_;
+	std::size_t next_ {};
+};
@@ -0,0 +1,83 @@
+// Copyright (c) 2017 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+// Steps the vectorized (AVX2, NEON) and the scalar kernel of the cpu
+// simulation on the same particles and compares the results.
+// Does not need vulkan. Skipped if there is no vectorized kernel.
+
+#include <cpuSimulation.hpp>
+#include <tests/particles.hpp>
+
+#include <vector> // std::vector
+#include <cstdio> // std::printf
+#include <cstring> // std::strcmp
+
+namespace {
+
+constexpr auto skipped = 77; // meson treats this exit code as skipped
+
+// no multiple of the vector widths, so the scalar tails run as well
+constexpr auto particleCount = 4099u;
+constexpr auto steps = 16u;
+constexpr auto delta = 0.01f;
+
+// returns the number of particles that differ after the steps
+unsigned int compare(float interactionRadius)
+{
+	CpuSimulation vectorized(1u);
+	CpuSimulation scalar(1u);
+	scalar.forceScalar(true);
+	vectorized.interactionRadius(interactionRadius);
+	scalar.interactionRadius(interactionRadius);
+
+	const std::vector<nytl::Vec2f> attractors = {
+		{0.25f, 0.5f},
+		{-0.5f, -0.25f},
+		{0.75f, -0.75f},
+	};
+
+	auto particles = test::randomParticles(particleCount, 42u);
+	auto mismatches = 0u;
+	for(auto i = 0u; i < steps; ++i) {
+		// both start from the same state in every step,
+		// differences would grow otherwise
+		vectorized.load(particles);
+		scalar.load(particles);
+		vectorized.step(delta, attractors);
+		scalar.step(delta, attractors);
+
+		auto v = vectorized.store();
+		auto s = scalar.store();
+		for(auto p = 0u; p < particleCount; ++p) {
+			if(test::differs(v[p], s[p])) {
+				++mismatches;
+			}
+		}
+
+		particles = s;
+	}
+
+	return mismatches;
+}
+
+} // anon namespace
+
+int main()
+{
+	CpuSimulation sim(1u);
+	if(!std::strcmp(sim.kernel(), "scalar")) {
+		std::printf("No vectorized kernel available, skipped\n");
+		return skipped;
+	}
+
+	auto failed = false;
+	for(auto radius : {0.f, 0.05f}) {
+		auto mismatches = compare(radius);
+		std::printf("%s, interaction radius %g: %u mismatches\n",
+			sim.kernel(), radius, mismatches);
+		failed |= (mismatches != 0u);
+	}
+
+	return failed ? 1 : 0;
+}
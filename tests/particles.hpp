@@ -0,0 +1,51 @@
+// Copyright (c) 2017 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+// Helpers shared by the tests comparing cpu simulation results.
+
+#pragma once
+
+#include <shaders/particles.h> // shader::Particle
+
+#include <vector> // std::vector
+#include <random> // std::mt19937
+#include <cmath> // std::abs
+#include <algorithm> // std::max
+
+namespace test {
+
+/// Particles with positions in [-range, range] and velocities in
+/// [-0.5, 0.5]. The same seed always gives the same particles.
+inline std::vector<shader::Particle> randomParticles(unsigned int count,
+	unsigned int seed, float range = 1.f)
+{
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<float> pos(-range, range);
+	std::uniform_real_distribution<float> vel(-0.5f, 0.5f);
+
+	std::vector<shader::Particle> ret(count);
+	for(auto& p : ret) {
+		p.pos = {pos(rng), pos(rng)};
+		p.vel = {vel(rng), vel(rng)};
+	}
+
+	return ret;
+}
+
+/// Whether the values differ by more than the tolerance relative to
+/// their magnitude (at least 1).
+inline bool differs(float a, float b, float tolerance = 1e-5f)
+{
+	auto scale = std::max(1.f, std::max(std::abs(a), std::abs(b)));
+	return std::abs(a - b) > tolerance * scale;
+}
+
+/// Whether position or velocity of the particles differ, see differs.
+inline bool differs(const shader::Particle& a, const shader::Particle& b)
+{
+	return differs(a.pos[0], b.pos[0]) || differs(a.pos[1], b.pos[1]) ||
+		differs(a.vel[0], b.vel[0]) || differs(a.vel[1], b.vel[1]);
+}
+
+} // namespace test
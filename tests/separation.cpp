@@ -0,0 +1,86 @@
+// Copyright (c) 2017 nyorain
+// Distributed under the Boost Software License, Version 1.0.
+// See accompanying file LICENSE or copy at http://www.boost.org/LICENSE_1_0.txt
+
+// Compares the particle interaction of the cpu simulation, which finds
+// the neighbours with the spatial hash of grid.comp, against checking
+// every pair of particles. Does not need vulkan.
+
+#include <cpuSimulation.hpp>
+#include <tests/particles.hpp>
+
+#include <vector> // std::vector
+#include <cmath> // std::sqrt
+#include <cstdio> // std::printf
+
+namespace {
+
+constexpr auto particleCount = 3000u;
+constexpr auto delta = 0.01f;
+
+// one step without attractors, the interaction of every pair
+std::vector<shader::Particle> bruteForce(
+		const std::vector<shader::Particle>& particles, float radius)
+{
+	auto friction = 1 - shader::frictionFactor * delta;
+	auto separation = shader::separationFactor * delta;
+
+	auto ret = particles;
+	for(auto i = 0u; i < particles.size(); ++i) {
+		auto fx = 0.f;
+		auto fy = 0.f;
+		for(auto& other : particles) {
+			auto dx = particles[i].pos[0] - other.pos[0];
+			auto dy = particles[i].pos[1] - other.pos[1];
+			auto dist = std::sqrt(dx * dx + dy * dy);
+			if(dist > 0.f && dist < radius) {
+				auto fac = 1.f - dist / radius;
+				fx += fac * (dx / dist);
+				fy += fac * (dy / dist);
+			}
+		}
+
+		auto& p = ret[i];
+		p.vel[0] = particles[i].vel[0] * friction + separation * fx;
+		p.vel[1] = particles[i].vel[1] * friction + separation * fy;
+		p.pos[0] += p.vel[0] * delta;
+		p.pos[1] += p.vel[1] * delta;
+	}
+
+	return ret;
+}
+
+} // anon namespace
+
+int main()
+{
+	auto particles = test::randomParticles(particleCount, 7u, 0.9f);
+	// duplicates (distance zero) are ignored by the interaction
+	particles[1].pos = particles[0].pos;
+
+	const std::vector<nytl::Vec2f> noAttractors;
+	auto failed = false;
+
+	// small radii put many cells into the same hash bins
+	for(auto radius : {0.005f, 0.02f, 0.1f}) {
+		CpuSimulation sim(1u);
+		sim.interactionRadius(radius);
+		sim.load(particles);
+		sim.step(delta, noAttractors);
+
+		auto grid = sim.store();
+		auto expected = bruteForce(particles, radius);
+		auto mismatches = 0u;
+		for(auto i = 0u; i < particleCount; ++i) {
+			if(test::differs(grid[i], expected[i])) {
+				++mismatches;
+			}
+		}
+
+		std::printf("interaction radius %g: %u mismatches\n", radius,
+			mismatches);
+		failed |= (mismatches != 0u);
+	}
+
+	return failed ? 1 : 0;
+}
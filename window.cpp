@@ -16,13 +16,14 @@
 #include <ny/windowSettings.hpp> // ny::WindowEdge
 #include <nytl/vecOps.hpp> // operator<<
 
-// TODO: to make this work for android, implement the surfaceCreated/surfaceDestroyed
-// methods
+#include <cmath> // std::pow
 
 void MainWindowListener::mouseButton(const ny::MouseButtonEvent& ev)
 {
 	mousePos = static_cast<nytl::Vec2f>(ev.position);
-	if(ev.button == ny::MouseButton::left) {
+	if(ev.button == ny::MouseButton::right) {
+		panning = ev.pressed;
+	} else if(ev.button == ny::MouseButton::left) {
 		mousePressed = ev.pressed;
 		if(ev.pressed) {
 			auto mods = ac().keyboardContext()->modifiers();
@@ -96,30 +97,40 @@ void MainWindowListener::key(const ny::KeyEvent& keyEvent)
 			wc().customDecorated(!wc().customDecorated());
 		}
 	} else if(keyEvent.pressed) {
+		// only requests the switch, the renderer logs when it happens
 		if(keycode == ny::Keycode::k1) {
-			dlg_info("Using no multisampling");
 			renderer->samples(vk::SampleCountBits::e1);
 		} else if(keycode == ny::Keycode::k2) {
-			dlg_info("Using 2 multisamples");
 			renderer->samples(vk::SampleCountBits::e2);
 		} else if(keycode == ny::Keycode::k4) {
-			dlg_info("Using 4 multisamples");
 			renderer->samples(vk::SampleCountBits::e4);
 		} else if(keycode == ny::Keycode::k8) {
-			dlg_info("Using 8 multisamples");
 			renderer->samples(vk::SampleCountBits::e8);
+		} else if(keycode == ny::Keycode::s) {
+			renderer->splat(!renderer->splat());
+		} else if(keycode == ny::Keycode::up) {
+			renderer->particleCount(2 * renderer->particleCount());
+		} else if(keycode == ny::Keycode::down) {
+			renderer->particleCount(renderer->particleCount() / 2);
+		} else if(keycode == ny::Keycode::k0) {
+			dlg_info("Resetting the view");
+			renderer->resetView();
 		}
 	}
 }
 void MainWindowListener::mouseMove(const ny::MouseMoveEvent& ev)
 {
-	mousePos = static_cast<nytl::Vec2f>(ev.position);
+	auto pos = static_cast<nytl::Vec2f>(ev.position);
+	if(panning) {
+		renderer->pan({pos[0] - mousePos[0], pos[1] - mousePos[1]});
+	}
+
+	mousePos = pos;
 }
 void MainWindowListener::mouseWheel(const ny::MouseWheelEvent& ev)
 {
-	// auto fac = std::pow(1.2, ev.value);
-	// attractFactor *= fac;
-	// renderer->mouseAttract *= fac;
+	auto fac = std::pow(1.2f, ev.value);
+	renderer->zoom(fac, mousePos);
 }
 void MainWindowListener::mouseCross(const ny::MouseCrossEvent& ev)
 {
@@ -154,7 +165,7 @@ void MainWindowListener::resize(const ny::SizeEvent& ev)
 	renderer->resize(ev.size);
 }
 
-// TODO: completetly recreating renderer is an overkill...
+// the renderer keeps simulating while there is no surface
 void MainWindowListener::surfaceCreated(const ny::SurfaceCreatedEvent& ev)
 {
 	dlg_info("Surface created!");
@@ -165,7 +176,6 @@ void MainWindowListener::surfaceCreated(const ny::SurfaceCreatedEvent& ev)
 void MainWindowListener::surfaceDestroyed(const ny::SurfaceDestroyedEvent&)
 {
 	dlg_info("Surface destroyed!");
-	renderer->wait();
 	renderer->surfaceDestroyed();
 	*wait = true;
 }
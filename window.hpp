@@ -30,6 +30,7 @@ public:
 	std::vector<TouchPoint> points;
 	nytl::Vec2f mousePos;
 	bool mousePressed;
+	bool panning {}; // right mouse button drags the view
 
 public:
 	MainWindowListener() = default;